@@ -1,6 +1,6 @@
 /* 
- * clock.c - Routines for using the cycle counters on x86, 
- *           Alpha, and Sparc boxes.
+ * clock.c - Routines for using the cycle counters on x86, x86-64,
+ *           AArch64, Alpha, and Sparc boxes.
  * 
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
@@ -8,15 +8,20 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/times.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
 #include "clock.h"
 
 
 /******************************************************* 
  * Machine dependent functions 
  *
- * Note: the constants __i386__ and  __alpha
+ * Note: the constants __i386__, __x86_64__, __aarch64__ and __alpha
  * are set by GCC when it calls the C preprocessor
  * You can verify this for yourself using gcc -v.
  *******************************************************/
@@ -71,6 +76,47 @@ double get_counter()
 }
 /* $end x86cyclecounter */
 
+#elif defined(__x86_64__) || defined(__aarch64__)
+/*****************************************************************
+ * x86-64 and AArch64 versions of start_counter() and get_counter()
+ *****************************************************************/
+
+/* The counter value recorded by start_counter */
+static uint64_t cyc_start = 0;
+
+/*
+ * read_counter - Read the 64-bit counter: the time stamp counter on
+ *     x86-64, the generic timer's virtual count on AArch64. rdtscp
+ *     waits for the instructions before it to finish, and so does
+ *     cntvct_el0 after an isb.
+ */
+static inline uint64_t read_counter(void)
+{
+#if defined(__x86_64__)
+    unsigned hi, lo, aux;
+
+    asm volatile("rdtscp" : "=a" (lo), "=d" (hi), "=c" (aux));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    uint64_t v;
+
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r" (v) : : "memory");
+    return v;
+#endif
+}
+
+/* Record the current value of the cycle counter. */
+void start_counter()
+{
+    cyc_start = read_counter();
+}
+
+/* Return the number of cycles since the last call to start_counter. */
+double get_counter()
+{
+    return (double)(read_counter() - cyc_start);
+}
+
 #elif defined(__alpha)
 
 /****************************************************
@@ -163,6 +209,73 @@ double get_counter()
 
 
 
+/*
+ * counter_available - Is there a cycle counter on this platform?
+ */
+int counter_available()
+{
+#if defined(__i386__) || defined(__x86_64__) || defined(__aarch64__) || \
+    defined(__alpha)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * counter_invariant - Does the cycle counter tick at a constant rate,
+ *     whatever the frequency and power state of the core? On x86 the
+ *     CPU says so in cpuid leaf 0x80000007; the AArch64 generic timer
+ *     always does.
+ */
+int counter_invariant()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned a, b, c, d;
+
+    if (__get_cpuid(0x80000007, &a, &b, &c, &d))
+	return (d >> 8) & 1;
+    return 0;
+#elif defined(__aarch64__)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * counter_mhz_reported - The counter rate in MHz that the hardware
+ *     reports, or 0 if it doesn't. On x86 that is cpuid leaf 0x15 (the
+ *     crystal clock and its ratio to the TSC), or else the TSC rate that
+ *     a hypervisor publishes in leaf 0x40000010. On AArch64 it is
+ *     cntfrq_el0.
+ */
+static double counter_mhz_reported(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned a, b, c, d;
+
+    if (__get_cpuid(0x15, &a, &b, &c, &d) && a != 0 && b != 0 && c != 0)
+	return (double)c * b / a / 1e6;
+    if (__get_cpuid(1, &a, &b, &c, &d) && (c >> 31) & 1) {
+	__cpuid(0x40000000, a, b, c, d);
+	if (a >= 0x40000010) {
+	    __cpuid(0x40000010, a, b, c, d);
+	    if (a != 0)
+		return a / 1e3; /* kHz */
+	}
+    }
+    return 0;
+#elif defined(__aarch64__)
+    uint64_t freq;
+
+    asm volatile("mrs %0, cntfrq_el0" : "=r" (freq));
+    return freq / 1e6;
+#else
+    return 0;
+#endif
+}
+
 /*******************************
  * Machine-independent functions
  ******************************/
@@ -201,6 +314,37 @@ double mhz(int verbose)
     return mhz_full(verbose, 2);
 }
 
+/*
+ * counter_mhz - The rate of the cycle counter in MHz. An invariant
+ *     counter's rate is taken from the hardware when it reports one.
+ *     Otherwise the counter is measured against CLOCK_MONOTONIC_RAW
+ *     for 100 ms, which is only meaningful if the counter is invariant
+ *     or the core's frequency holds still.
+ */
+double counter_mhz(int verbose)
+{
+    struct timespec nap = {0, 100000000}, t0, t1;
+    double rate, cycles, ns;
+
+    if (counter_invariant() && (rate = counter_mhz_reported()) > 0) {
+	if (verbose)
+	    printf("Cycle counter rate = %.1f MHz (reported)\n", rate);
+	return rate;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t0);
+    start_counter();
+    nanosleep(&nap, NULL);
+    cycles = get_counter();
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+    ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    rate = cycles / ns * 1e3;
+    if (verbose)
+	printf("Cycle counter rate ~= %.1f MHz (measured%s)\n", rate,
+	       counter_invariant() ? "" : ", not invariant");
+    return rate;
+}
+
 /** Special counters that compensate for timer interrupt overhead */
 
 static double cyc_per_tick = 0.0;
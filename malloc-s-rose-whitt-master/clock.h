@@ -15,6 +15,13 @@ double mhz(int verbose);
 /* Determine clock rate of processor, having more control over accuracy */
 double mhz_full(int verbose, int sleeptime);
 
+/* Is there a cycle counter, and does it tick at a constant rate? */
+int counter_available();
+int counter_invariant();
+
+/* Determine the rate of the cycle counter, preferring what the CPU reports */
+double counter_mhz(int verbose);
+
 /** Special counters that compensate for timer interrupt overhead */
 
 void start_comp_counter();
@@ -35,15 +35,19 @@
   "realloc2-bal.rep"
 
 /*
- * This constant gives the estimated performance of a good malloc
- * package using our traces on some reference system, typically the
- * same kind of system the students use. Its purpose is to cap the
- * contribution of throughput to the performance index. Once the
- * students surpass the AVG_LIBC_THRUPUT, they get no further benefit
- * to their score.  This deters students from building extremely fast,
- * but extremely stupid malloc packages.
+ * The throughput of a good malloc package caps the contribution of
+ * throughput to the performance index. Once the students surpass it,
+ * they get no further benefit to their score.  This deters students
+ * from building extremely fast, but extremely stupid malloc packages.
+ *
+ * mdriver measures that throughput on the host it runs on, by replaying
+ * the same traces against the libc malloc package.  Each trace's libc
+ * time is cached in this file in the home directory, under the CPU
+ * model, the way it was timed and the trace file's size and
+ * modification time, so that it is measured only once per kind of
+ * machine (or again with -C).
  */
-#define AVG_LIBC_THRUPUT      54500E3  /* 54,500 Kops/sec */
+#define LIBC_CACHE ".mdriver-libc"
 
  /* 
   * This constant determines the contributions of space utilization
@@ -58,15 +62,32 @@
 #define ALIGNMENT 8
 
 /* 
- * Maximum heap size in bytes 
+ * Default maximum heap size in bytes.  Only address space is reserved up
+ * front, so this can be raised at runtime with the -m flag.
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/*
+ * Set MM_THREAD_SAFE to "1" if mm_malloc, mm_free and mm_realloc may be
+ * called by several threads at once.  Otherwise, when the driver replays
+ * a threaded trace, it holds a lock around every call.
+ */
+#define MM_THREAD_SAFE 0
+
 /*****************************************************************************
- * Set exactly one of these USE_xxx constants to "1" to select a timing method
+ * The timing method used unless another is chosen with -T:
+ *   "fcyc"    cycle counter w/K-best scheme (x86, x86-64, AArch64 & Alpha)
+ *   "itimer"  interval timer (any Unix box)
+ *   "gettod"  gettimeofday (any Unix box)
+ *   "mono"    clock_gettime(CLOCK_MONOTONIC_RAW) (any Linux box)
  *****************************************************************************/
-#define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
-#define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define DEFAULT_TIMER "mono"
+
+/*
+ * In benchmark mode (-b), each trace is timed at least BENCH_MIN_RUNS
+ * and by default at most BENCH_MAX_RUNS times.
+ */
+#define BENCH_MIN_RUNS 5
+#define BENCH_MAX_RUNS 100
 
 #endif /* __CONFIG_H */
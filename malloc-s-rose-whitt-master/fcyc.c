@@ -30,6 +30,7 @@ static int compensate = COMPENSATE;
 static int clear_cache = CLEAR_CACHE;
 static int cache_bytes = CACHE_BYTES;
 static int cache_block = CACHE_BLOCK;
+static stall_funct stall = NULL;
 
 static int *cache_buf = NULL;
 
@@ -135,9 +136,13 @@ double fcyc(test_funct f, void *argp)
 	    double cyc;
 	    if (clear_cache)
 		clear();
+	    if (stall)
+		stall(argp);
 	    start_comp_counter();
 	    f(argp);
 	    cyc = get_comp_counter();
+	    if (stall)
+		cyc -= stall(argp);
 	    add_sample(cyc);
 	} while (!has_converged() && samplecount < maxsamples);
     } else {
@@ -145,9 +150,13 @@ double fcyc(test_funct f, void *argp)
 	    double cyc;
 	    if (clear_cache)
 		clear();
+	    if (stall)
+		stall(argp);
 	    start_counter();
 	    f(argp);
 	    cyc = get_counter();
+	    if (stall)
+		cyc -= stall(argp);
 	    add_sample(cyc);
 	} while (!has_converged() && samplecount < maxsamples);
     }
@@ -249,3 +258,13 @@ void set_fcyc_epsilon(double epsilon_arg)
 
 
 
+
+/* 
+ * set_fcyc_stall - When set, the cycles that stall reports for each
+ *     measurement are not counted.
+ *     Default = NULL
+ */
+void set_fcyc_stall(stall_funct stall_arg)
+{
+    stall = stall_arg;
+}
@@ -10,6 +10,9 @@
 /* The test function takes a generic pointer as input */
 typedef void (*test_funct)(void *);
 
+/* Returns the cycles that f(argp) has stalled since the last call */
+typedef double (*stall_funct)(void *);
+
 /* Compute number of cycles used by test function f */
 double fcyc(test_funct f, void* argp);
 
@@ -63,6 +66,13 @@ void set_fcyc_maxsamples(int maxsamples_arg);
  */
 void set_fcyc_epsilon(double epsilon_arg);
 
+/* 
+ * set_fcyc_stall - When set, the cycles that stall reports for each
+ *     measurement are not counted.
+ *     Default = NULL
+ */
+void set_fcyc_stall(stall_funct stall_arg);
+
 
 
 
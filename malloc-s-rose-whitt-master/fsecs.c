@@ -2,41 +2,84 @@
  * High-level timing wrappers
  ****************************/
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include "fsecs.h"
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
 #include "config.h"
 
+/* The timing methods that fsecs can use */
+enum {TIMER_FCYC, TIMER_ITIMER, TIMER_GETTOD, TIMER_MONO, NUM_TIMERS};
+
+static char *timer_names[NUM_TIMERS] = {"fcyc", "itimer", "gettod", "mono"};
+
+static int timer = TIMER_GETTOD; /* the method chosen by init_fsecs */
 static double Mhz;  /* estimated CPU clock frequency */
+static fsecs_stall_funct stall = NULL; /* see set_fsecs_stall */
+
+/* Parameters of fsecs_bench (see set_fsecs_bench) */
+static int bench_warmup = 0;
+static double bench_rel_ci = 0.01;
+static int bench_max_runs = BENCH_MAX_RUNS;
+
+static double time_once(fsecs_test_funct f, void *argp);
+static double stalled(void *argp);
+static double stall_cycles(void *argp);
+static void bench_stats(double *secs, int n, fsecs_stats_t *st);
+static double t_quantile(int df);
+static int cmp_double(const void *a, const void *b);
 
 extern int verbose; /* -v option in mdriver.c */
 
 /*
- * init_fsecs - initialize the timing package
+ * init_fsecs - initialize the timing package to use the timing method
+ *     called name (see config.h). Returns 0 on success, or -1 if there
+ *     is no such method on this platform.
  */
-void init_fsecs(void)
+int init_fsecs(char *name)
 {
+    for (timer = 0; timer < NUM_TIMERS; timer++)
+	if (!strcmp(name, timer_names[timer]))
+	    break;
+
     Mhz = 0; /* keep gcc -Wall happy */
 
-#if USE_FCYC
-    if (verbose)
-	printf("Measuring performance with a cycle counter.\n");
+    switch (timer) {
+    case TIMER_FCYC:
+	if (!counter_available())
+	    return -1;
+	if (verbose)
+	    printf("Measuring performance with a cycle counter.\n");
 
-    /* set key parameters for the fcyc package */
-    set_fcyc_maxsamples(20); 
-    set_fcyc_clear_cache(1);
-    set_fcyc_compensate(1);
-    set_fcyc_epsilon(0.01);
-    set_fcyc_k(3);
-    Mhz = mhz(verbose > 0);
-#elif USE_ITIMER
-    if (verbose)
-	printf("Measuring performance with the interval timer.\n");
-#elif USE_GETTOD
-    if (verbose)
-	printf("Measuring performance with gettimeofday().\n");
-#endif
+	/* set key parameters for the fcyc package */
+	set_fcyc_maxsamples(20); 
+	set_fcyc_clear_cache(1);
+	set_fcyc_compensate(1);
+	set_fcyc_epsilon(0.01);
+	set_fcyc_k(3);
+	Mhz = counter_mhz(verbose > 0);
+	if (!counter_invariant())
+	    printf("Warning: the cycle counter's rate varies with the "
+		   "CPU clock, so times may be off.\n");
+	return 0;
+    case TIMER_ITIMER:
+	if (verbose)
+	    printf("Measuring performance with the interval timer.\n");
+	return 0;
+    case TIMER_GETTOD:
+	if (verbose)
+	    printf("Measuring performance with gettimeofday().\n");
+	return 0;
+    case TIMER_MONO:
+	if (verbose)
+	    printf("Measuring performance with CLOCK_MONOTONIC_RAW.\n");
+	return 0;
+    default:
+	return -1;
+    }
 }
 
 /*
@@ -44,14 +87,194 @@ void init_fsecs(void)
  */
 double fsecs(fsecs_test_funct f, void *argp) 
 {
-#if USE_FCYC
-    double cycles = fcyc(f, argp);
-    return cycles/(Mhz*1e6);
-#elif USE_ITIMER
-    return ftimer_itimer(f, argp, 10);
-#elif USE_GETTOD
-    return ftimer_gettod(f, argp, 10);
-#endif 
+    double secs;
+
+    stalled(argp);
+    switch (timer) {
+    case TIMER_FCYC:
+	return fcyc(f, argp)/(Mhz*1e6);
+    case TIMER_ITIMER:
+	secs = ftimer_itimer(f, argp, 10);
+	break;
+    case TIMER_MONO:
+	secs = ftimer_mono(f, argp, 10);
+	break;
+    default:
+	secs = ftimer_gettod(f, argp, 10);
+	break;
+    }
+    return secs - stalled(argp)/10;
+}
+
+/*
+ * set_fsecs_stall - leave the time that stall(argp) reports out of
+ *     every run of f that is timed, so that all of the statistics are
+ *     computed on net times.  stall returns the seconds that f has
+ *     stalled since its last call.
+ */
+void set_fsecs_stall(fsecs_stall_funct stall_arg)
+{
+    stall = stall_arg;
+    set_fcyc_stall(stall != NULL ? stall_cycles : NULL);
+}
+
+/*
+ * set_fsecs_bench - set the parameters of fsecs_bench: the number of
+ *     untimed warmup runs, the target half-width of the 95% confidence
+ *     interval relative to the mean, and the most runs to time
+ */
+void set_fsecs_bench(int warmup, double rel_ci, int max_runs)
+{
+    bench_warmup = warmup;
+    bench_rel_ci = rel_ci;
+    bench_max_runs = max_runs < BENCH_MIN_RUNS ? BENCH_MIN_RUNS : max_runs;
+}
+
+/*
+ * fsecs_bench - Time f one run at a time until the confidence interval
+ *     of the mean is narrow enough, or the runs run out. Returns the
+ *     mean running time of f in seconds, and stores the spread of the
+ *     runs in *st. Runs that are outliers by the modified z-score test
+ *     are left out: they are interrupts and page faults, not f.
+ */
+double fsecs_bench(fsecs_test_funct f, void *argp, fsecs_stats_t *st)
+{
+    double *secs;
+    int i, n;
+
+    if ((secs = malloc(bench_max_runs * sizeof(double))) == NULL) {
+	printf("ERROR: malloc failed in fsecs_bench\n");
+	exit(1);
+    }
+    for (i = 0; i < bench_warmup; i++)
+	f(argp);
+
+    for (n = 0; n < bench_max_runs; ) {
+	secs[n++] = time_once(f, argp);
+	if (n < BENCH_MIN_RUNS)
+	    continue;
+	bench_stats(secs, n, st);
+	if (st->converged)
+	    break;
+    }
+    free(secs);
+    return st->mean;
+}
+
+/*
+ * time_once - Return the running time of one run of f (in seconds)
+ */
+static double time_once(fsecs_test_funct f, void *argp)
+{
+    double secs;
+
+    stalled(argp);
+    switch (timer) {
+    case TIMER_FCYC:
+	start_counter();
+	f(argp);
+	secs = get_counter()/(Mhz*1e6);
+	break;
+    case TIMER_ITIMER:
+	secs = ftimer_itimer(f, argp, 1);
+	break;
+    case TIMER_MONO:
+	secs = ftimer_mono(f, argp, 1);
+	break;
+    default:
+	secs = ftimer_gettod(f, argp, 1);
+	break;
+    }
+    return secs - stalled(argp);
+}
+
+/*
+ * stalled - the seconds that f(argp) has stalled since the last call
+ *     (see set_fsecs_stall), and stall_cycles - the same in cycles,
+ *     for fcyc
+ */
+static double stalled(void *argp)
+{
+    return stall != NULL ? stall(argp) : 0;
+}
+
+static double stall_cycles(void *argp)
+{
+    return stalled(argp) * Mhz * 1e6;
+}
+
+/*
+ * bench_stats - compute the statistics of the n runs in secs, less the
+ *     outliers. A run is an outlier if its modified z-score,
+ *     0.6745 |x - median| / MAD, exceeds 3.5 (Iglewicz and Hoaglin).
+ */
+static void bench_stats(double *secs, int n, fsecs_stats_t *st)
+{
+    double *x, *dev, median, mad, sum = 0, ss = 0;
+    int i, k = 0;
+
+    x = malloc(n * sizeof(double));
+    dev = malloc(n * sizeof(double));
+    if (x == NULL || dev == NULL) {
+	printf("ERROR: malloc failed in bench_stats\n");
+	exit(1);
+    }
+
+    /* The median and the median absolute deviation of all the runs */
+    memcpy(x, secs, n * sizeof(double));
+    qsort(x, n, sizeof(double), cmp_double);
+    median = (x[(n - 1) / 2] + x[n / 2]) / 2;
+    for (i = 0; i < n; i++)
+	dev[i] = fabs(x[i] - median);
+    qsort(dev, n, sizeof(double), cmp_double);
+    mad = (dev[(n - 1) / 2] + dev[n / 2]) / 2;
+
+    /* Keep the runs that are not outliers; x stays sorted */
+    for (i = 0; i < n; i++)
+	if (mad == 0 || 0.6745 * fabs(x[i] - median) / mad <= 3.5)
+	    x[k++] = x[i];
+
+    for (i = 0; i < k; i++)
+	sum += x[i];
+    st->runs = k;
+    st->outliers = n - k;
+    st->mean = sum / k;
+    for (i = 0; i < k; i++)
+	ss += (x[i] - st->mean) * (x[i] - st->mean);
+    st->stddev = k > 1 ? sqrt(ss / (k - 1)) : 0;
+    st->median = (x[(k - 1) / 2] + x[k / 2]) / 2;
+    st->ci = k > 1 ? t_quantile(k - 1) * st->stddev / sqrt(k) : 0;
+    st->converged = (k > 1 && st->ci <= bench_rel_ci * st->mean);
+    free(x);
+    free(dev);
+}
+
+/*
+ * t_quantile - the 97.5th percentile of Student's t distribution with
+ *     df degrees of freedom: exact to three places up to 30, and from
+ *     the Cornish-Fisher expansion beyond
+ */
+static double t_quantile(int df)
+{
+    static const double t[30] = {
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+    double z = 1.959964;
+
+    if (df <= 30)
+	return t[df - 1];
+    return z + (z*z*z + z) / (4.0 * df) +
+	(5*z*z*z*z*z + 16*z*z*z + 3*z) / (96.0 * df * df);
 }
 
+/*
+ * cmp_double - qsort comparison function for doubles
+ */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
 
+    return (x > y) - (x < y);
+}
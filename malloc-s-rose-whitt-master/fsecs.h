@@ -1,4 +1,21 @@
 typedef void (*fsecs_test_funct)(void *);
 
-void init_fsecs(void);
+/* Returns the seconds that f(argp) has stalled since the last call */
+typedef double (*fsecs_stall_funct)(void *);
+
+/* The spread of the runs that fsecs_bench timed */
+typedef struct {
+    int runs;        /* runs kept (0 if fsecs_bench was not used) */
+    int outliers;    /* runs rejected as outliers */
+    int converged;   /* did the confidence interval reach its target? */
+    double mean;     /* mean, median and standard deviation of the kept runs */
+    double median;
+    double stddev;
+    double ci;       /* half-width of the 95% confidence interval of the mean */
+} fsecs_stats_t;
+
+int init_fsecs(char *name);
 double fsecs(fsecs_test_funct f, void *argp);
+void set_fsecs_stall(fsecs_stall_funct stall);
+void set_fsecs_bench(int warmup, double rel_ci, int max_runs);
+double fsecs_bench(fsecs_test_funct f, void *argp, fsecs_stats_t *st);
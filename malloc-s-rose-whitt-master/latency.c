@@ -0,0 +1,116 @@
+/*
+ * latency.c - Tick counter calibration and latency histograms
+ *
+ * lat_init finds two things. On x86 the ticks are time stamp counter
+ * cycles, so their rate comes from counter_mhz in clock.c. The timer
+ * overhead is the smallest number of ticks between a lat_start and a
+ * lat_stop with nothing in between; callers subtract it from every
+ * interval they record, so that what is left is the time spent in the
+ * code being timed.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "latency.h"
+#include "clock.h"
+
+#define OVERHEAD_RUNS 10000  /* empty intervals timed by lat_init */
+
+static double ticks_per_ns = 1;
+static uint64_t overhead = 0;
+
+/*
+ * lat_init - calibrate the tick counter and its overhead
+ */
+void lat_init(void)
+{
+    uint64_t t0, t1, d;
+    int i;
+
+#if defined(__x86_64__) || defined(__i386__)
+    ticks_per_ns = counter_mhz(0) / 1e3;
+#endif
+
+    overhead = UINT64_MAX;
+    for (i = 0; i < OVERHEAD_RUNS; i++) {
+	t0 = lat_start();
+	t1 = lat_stop();
+	if ((d = t1 - t0) < overhead)
+	    overhead = d;
+    }
+}
+
+/*
+ * lat_ticks_per_ns - the rate of the tick counter
+ */
+double lat_ticks_per_ns(void)
+{
+    return ticks_per_ns;
+}
+
+/*
+ * lat_overhead - the ticks that timing an empty interval takes
+ */
+uint64_t lat_overhead(void)
+{
+    return overhead;
+}
+
+/*
+ * hist_clear - empty a histogram
+ */
+void hist_clear(hist_t *h)
+{
+    memset(h, 0, sizeof(hist_t));
+}
+
+/*
+ * hist_add - record a value in a histogram
+ */
+void hist_add(hist_t *h, uint64_t ticks)
+{
+    unsigned e, i;
+
+    if (ticks < (1u << HIST_SUB_BITS))
+	i = ticks;
+    else {
+	/* e is the position of the top bit; keep HIST_SUB_BITS below it */
+	e = 63 - __builtin_clzll(ticks);
+	i = ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+	    (unsigned)(ticks >> (e - HIST_SUB_BITS)) - (1u << HIST_SUB_BITS);
+    }
+    h->buckets[i]++;
+    h->count++;
+    if (ticks > h->max)
+	h->max = ticks;
+}
+
+/*
+ * hist_percentile - the value that pct percent of the recorded values
+ *     are no larger than, rounded up to the top of its bucket (but never
+ *     above the largest value recorded)
+ */
+uint64_t hist_percentile(hist_t *h, double pct)
+{
+    uint64_t rank, seen = 0, top;
+    unsigned i, b, s;
+
+    if (h->count == 0)
+	return 0;
+    rank = (uint64_t)(pct / 100 * h->count + 0.5);
+    if (rank < 1)
+	rank = 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+	if ((seen += h->buckets[i]) >= rank)
+	    break;
+    }
+
+    /* Top value of bucket i */
+    b = i >> HIST_SUB_BITS;
+    s = i & ((1u << HIST_SUB_BITS) - 1);
+    if (b == 0)
+	top = s;
+    else
+	top = (((uint64_t)(s + (1u << HIST_SUB_BITS)) + 1) << (b - 1)) - 1;
+    return top < h->max ? top : h->max;
+}
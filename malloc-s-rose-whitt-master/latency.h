@@ -0,0 +1,67 @@
+/*
+ * Time single allocator requests and collect their latencies in
+ * log-linear histograms, like HdrHistogram: values below 2^HIST_SUB_BITS
+ * ticks get a bucket each, and every power of two above that is split
+ * into 2^HIST_SUB_BITS equal buckets, so a bucket is never wider than
+ * 1/32 of the values it holds.
+ *
+ * A tick is a time stamp counter cycle on x86, and a nanosecond
+ * elsewhere. Call lat_init once before using the rest.
+ */
+#ifndef __LATENCY_H_
+#define __LATENCY_H_
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define HIST_SUB_BITS 5
+#define HIST_BUCKETS  ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+typedef struct {
+    uint64_t count;             /* number of values recorded */
+    uint64_t max;               /* largest of them */
+    uint64_t buckets[HIST_BUCKETS];
+} hist_t;
+
+void lat_init(void);
+double lat_ticks_per_ns(void);
+uint64_t lat_overhead(void);
+void hist_clear(hist_t *h);
+void hist_add(hist_t *h, uint64_t ticks);
+uint64_t hist_percentile(hist_t *h, double pct);
+
+/*
+ * lat_start, lat_stop - read the tick counter before and after the code
+ *     being timed. The fences keep that code from drifting out of the
+ *     timed interval.
+ */
+static inline uint64_t lat_start(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_lfence();
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline uint64_t lat_stop(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned aux;
+    uint64_t t = __rdtscp(&aux);
+
+    _mm_lfence();
+    return t;
+#else
+    return lat_start();
+#endif
+}
+
+#endif /* __LATENCY_H_ */
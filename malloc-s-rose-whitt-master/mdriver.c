@@ -7,6 +7,7 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,10 +16,25 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <limits.h>
+#include <math.h>
 #include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#include <getopt.h>
+#include <sys/wait.h>
+#include <sys/utsname.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "trace.h"
+#include "payload.h"
+#include "latency.h"
+#include "perfctr.h"
 #include "fsecs.h"
 #include "config.h"
 
@@ -29,7 +45,11 @@
 /* Misc */
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
-#define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define LINENUM(t, i) ((t)->first_line + (i)) /* cnvt request nums to linenums */
+#define CACHE_LINE    64 /* bytes of a payload touched by --touch=line */
+
+/* Pattern step for the payload of request id i (see payload.h) */
+#define STEP(i) (pos_pattern ? 2 * (i) + 1 : 0)
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
@@ -38,30 +58,18 @@
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
-typedef struct range_t {
-    char *lo;              /* low payload address */
-    char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
-} range_t;
-
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
-/* Holds the information for one trace file*/
+/* 
+ * Shadow map of the heap, with one bit per ALIGNMENT-byte granule. A
+ * bit is set while an allocated payload covers any byte of its granule.
+ * Since payloads start on granule boundaries, two payloads overlap
+ * exactly when they cover a common granule.
+ */
 typedef struct {
-    unsigned sugg_heapsize;   /* suggested heap size (unused) */
-    unsigned num_ids;         /* number of alloc/realloc ids */
-    unsigned num_ops;         /* number of distinct requests */
-    unsigned weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
-    char **blocks;       /* array of ptrs returned by malloc/realloc... */
-    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
-} trace_t;
+    char *base;            /* heap address of granule 0 */
+    unsigned long *bits;   /* the bitmap itself */
+    size_t nwords;         /* number of words in the bitmap */
+    size_t hiword;         /* 1 + highest word set since the last clear */
+} shadow_t;
 
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
@@ -70,27 +78,128 @@ typedef struct {
  */
 typedef struct {
     trace_t *trace;  
-    range_t *ranges;
+    int touch;               /* how to touch the payloads (--touch) */
+    unsigned *leftover;      /* ids of the blocks the trace never frees... */
+    unsigned num_leftover;   /* ... and how many there are */
+    struct replay *threads;  /* threaded traces: one replay per thread... */
+    unsigned *gen;           /* ... allocs and reallocs done on each id... */
+    pthread_barrier_t start; /* ... barriers at the start of each replay... */
+    pthread_barrier_t finish; /* ... and at its end... */
+    int libc;                /* ... whether it is against libc malloc... */
+    int quit;                /* ... and whether the threads should exit */
 } speed_t;
 
+/* The requests of one thread of a threaded trace, and its fastest replay */
+typedef struct replay {
+    speed_t *params;     /* the replay this thread is part of */
+    pthread_t thread;
+    traceop_t *ops;      /* the thread's requests, in trace order */
+    unsigned num_ops;
+    double secs;         /* shortest time the thread took to replay them */
+} replay_t;
+
+/* Latency percentiles of one type of request, in ns (-l) */
+typedef struct {
+    unsigned long count;  /* requests timed */
+    double p50, p99, p999, max;
+} latency_t;
+
+/* Free blocks are split into classes < 64, < 256, ..., >= 64K bytes (-u) */
+#define FRAG_CLASSES 7
+
+/* The layout of the heap at one point in a trace (-u) */
+typedef struct {
+    unsigned op;        /* requests replayed so far */
+    size_t heap;        /* heap size */
+    size_t payload;     /* live payload bytes */
+    size_t allocated;   /* bytes in allocated blocks, headers and padding too */
+    size_t free;        /* bytes in free blocks... */
+    size_t free_class[FRAG_CLASSES]; /* ... split by block size */
+    size_t largest;     /* the largest free block */
+} heapsample_t;
+
+/* Fragmentation over a whole trace, averaged over its samples (-u) */
+typedef struct {
+    unsigned samples;
+    double internal;    /* share of the heap in allocated blocks, not payload */
+    double external;    /* share of the heap in free blocks */
+    double scattered;   /* share of free bytes outside the largest free block */
+    unsigned grew_at;   /* the sample after which the heap grew the most... */
+    size_t grew_by;     /* ... and by how many bytes */
+} frag_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    double touch_secs; /* ... with its payloads touched (--touch) */
+    double null_secs; /* ... against the null allocator (-n) */
+    double libc_secs; /* ... by the libc malloc package */
+    int libc_measured; /* was libc_secs measured now, rather than cached? */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double rss_util; /* utilization relative to the peak resident heap */
+    fsecs_stats_t bench; /* spread of the timed runs in benchmark mode (-b) */
+    latency_t latency[3]; /* latencies of each request type (-l) */
+    frag_t frag;     /* fragmentation of the heap over the trace (-u) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* What a worker sends back over its pipe after evaluating a trace (-j) */
+typedef struct {
+    int tracenum;    /* the trace it evaluated */
+    int errors;      /* number of errors it found in that trace */
+    stats_t stats;   /* the trace's results */
+} report_t;
+
+/* The cached libc malloc time of a trace (see LIBC_CACHE) */
+typedef struct {
+    unsigned ops;    /* requests in the trace when it was timed */
+    double secs;     /* its libc time, or 0 if none was cached */
+} libc_ref_t;
+
+/* Formats of the machine-readable results (--format) */
+enum {FORMAT_NONE, FORMAT_JSON, FORMAT_CSV};
+
+/* Long-only options */
+enum {OPT_FORMAT = 256, OPT_OUTPUT, OPT_COMPARE, OPT_THRESHOLD, OPT_TOUCH};
+
+/* How the speed replay touches payloads (--touch) */
+enum {TOUCH_NONE, TOUCH_LINE, TOUCH_FULL};
+
+/* The host that the results were measured on, and how it was set up */
+typedef struct {
+    char hostname[MAXLINE];
+    char kernel[MAXLINE];
+    char cpu[MAXLINE];
+    long cpus;
+    char affinity[MAXLINE];  /* the CPUs mdriver may run on (-P) */
+    char governor[MAXLINE];  /* cpufreq governor of the first of them... */
+    double mhz;              /* ... and its current clock rate, or 0 */
+    int nice;                /* scheduling priority (-R) */
+    int locked;              /* was the heap locked in memory? (-L) */
+} host_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int pos_pattern = 0; /* fill payloads with position-dependent bytes */
+static unsigned lat_every = 0; /* time one in this many requests (-l) */
+static unsigned frag_every = 0; /* sample the heap this often (-u) */
+static int use_counters = 0; /* count hardware events per trace (-c) */
+static int bench = 0;   /* time traces with fsecs_bench (-b) */
+static int lock_heap = 0; /* lock the simulated heap in memory (-L) */
+static int calibrate = 0; /* measure the driver's overhead (-n) */
+static libc_ref_t *libc_ref; /* cached libc time of each trace */
+static uintptr_t null_brk; /* next address the null allocator returns */
+static int touch = TOUCH_NONE; /* also time traces touching payloads (--touch) */
+static volatile unsigned long touch_sink; /* keeps payload loads alive */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -106,27 +215,87 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
-		     int tracenum, int opnum);
-static void remove_range(range_t **ranges, char *lo);
-static void clear_ranges(range_t **ranges);
-
-/* These functions read, allocate, and free storage for traces */
-static trace_t *read_trace(char *tracedir, char *filename);
-static void free_trace(trace_t *trace);
+/* these functions manipulate the shadow map */
+static void init_shadow(shadow_t *shadow);
+static int add_range(shadow_t *shadow, char *lo, int size, 
+		     int tracenum, int linenum);
+static void remove_range(shadow_t *shadow, char *lo, int size);
+static void clear_ranges(shadow_t *shadow);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static int eval_mm_valid(trace_t *trace, int tracenum, shadow_t *shadow);
+static double eval_mm_util(trace_t *trace, int tracenum, double *rss_util,
+			   heapsample_t *samples, unsigned *num_samples);
 static void eval_mm_speed(void *ptr);
+static void eval_null_speed(void *ptr);
+static void eval_libc_speed(void *ptr);
+static void eval_libc_threads(void *ptr);
+static void find_leftovers(trace_t *trace, speed_t *params);
+static void replay_packed_mm(trace_t *trace);
+static void replay_packed_null(trace_t *trace);
+static void replay_packed_libc(trace_t *trace);
+static void *null_malloc(size_t size);
+static void null_free(void *ptr);
+static void *null_realloc(void *ptr, size_t size);
+static void eval_mm_threads(void *ptr);
+static void eval_mm_threads_once(void *ptr);
+static void eval_mm_latency(trace_t *trace, hist_t *hists);
+static void eval_mm_counters(fsecs_test_funct f, speed_t *params,
+			     int tracenum);
+static void *replay_thread(void *arg);
+static void *mm_malloc_locked(size_t size);
+static void mm_free_locked(void *ptr);
+static void *mm_realloc_locked(void *ptr, size_t size);
+static void split_threads(trace_t *trace, speed_t *params);
+static void start_threads(speed_t *params);
+static void stop_threads(speed_t *params);
+static void eval_trace(char *tracefile, int tracenum, int stream,
+		       shadow_t *shadow, stats_t *stats);
+static void eval_parallel(char **tracefiles, int num_tracefiles, int jobs,
+			  int stream, stats_t *stats);
 
 /* Various helper routines */
+static void touch_pages(char *p, size_t size);
+static void init_heap(void);
+static int parse_cpus(char *s, cpu_set_t *set);
+static void format_cpus(cpu_set_t *set, char *buf, size_t size);
+static int read_first_line(char *path, char *buf, size_t size);
+static ssize_t readn(int fd, void *buf, size_t n);
+static double time_trace(fsecs_test_funct f, speed_t *params,
+			 stats_t *stats);
+static double speed_stall(void *ptr);
+static double time_touched(fsecs_test_funct f, speed_t *params);
+static inline void write_payload(char *p, unsigned size, int touch);
+static inline unsigned long read_payload(char *p, unsigned size, int touch);
 static void printresults(int n, stats_t *stats);
+static void printbench(int n, stats_t *stats);
+static void printtouch(int n, stats_t *stats);
+static void printnull(int n, stats_t *stats);
+static void printlatency(int tracenum, latency_t *latency);
+static void sample_heap(heapsample_t *sample, unsigned op, size_t payload);
+static void visit_block(void *bp, size_t size, int allocated, void *arg);
+static void summarize_frag(heapsample_t *samples, unsigned n, frag_t *frag);
+static void printfrag(int tracenum, heapsample_t *samples, unsigned n,
+		      frag_t *frag);
+static void get_host(host_t *host);
+static void printhost(host_t *host);
+static int libc_cache_path(char *path);
+static void trace_key(char *tracefile, char *key);
+static void load_libc_cache(char *cpu, char *method, char **tracefiles,
+			    int n);
+static void save_libc_cache(char *cpu, char *method, char **tracefiles,
+			    int n, stats_t *stats);
+static void write_results(FILE *out, int format, char **tracefiles, int n,
+			  stats_t *stats, double perfindex, char *timer);
+static void write_json_string(FILE *out, char *s);
+static void write_csv_string(FILE *out, char *s);
+static double json_number(char *line, char *key);
+static int compare_results(char *path, char **tracefiles, int n,
+			   stats_t *stats, double threshold);
 static void usage(void);
 static void unix_error(char *msg);
-static void malloc_error(int tracenum, int opnum, char *msg);
+static void malloc_error(int tracenum, int linenum, char *msg);
 static void app_error(char *msg);
 
 /**************
@@ -134,17 +303,46 @@ static void app_error(char *msg);
  **************/
 int main(int argc, char **argv)
 {
-    int i;
-    char c;
+    int i, c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
-    trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
+    shadow_t shadow;           /* keeps track of block extents for one trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
-    speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int stream = 0;      /* If set, stream traces instead of loading them */
+    long jobs = 1;       /* number of traces to evaluate at once (-j) */
+    unsigned long maxheap_mb; /* maximum heap size in MB (-m) */
+    double sbrk_call_ns = 0, sbrk_page_ns = 0; /* mem_sbrk costs (-s) */
+    char *timer = DEFAULT_TIMER; /* timing method (-T) */
+    long warmup, max_runs;     /* benchmark mode parameters (-b) */
+    double rel_ci;
+    int format = FORMAT_NONE;  /* machine-readable results (--format) */
+    char *output = NULL;       /* ... written here instead of stdout */
+    char *baseline = NULL;     /* results to compare against (--compare) */
+    double threshold = 5;      /* % change that counts as a regression */
+    cpu_set_t pin;             /* CPUs to run on (-P) */
+    int pinned = 0;
+    int raise_priority = 0;    /* run at the highest priority (-R) */
+    int fresh = 0;             /* regrow the heap from fresh pages (-F) */
+    int recalibrate = 0;       /* time libc malloc even if cached (-C) */
+    double libc_secs, libc_thruput; /* the throughput reference */
+    char method[MAXLINE];      /* how it is timed, for the libc cache */
+    host_t host;
+    int regressions = 0;
+    FILE *out = NULL;
+    int fd;
+    static struct option longopts[] = {
+	{"format", required_argument, NULL, OPT_FORMAT},
+	{"output", required_argument, NULL, OPT_OUTPUT},
+	{"compare", required_argument, NULL, OPT_COMPARE},
+	{"threshold", required_argument, NULL, OPT_THRESHOLD},
+	{"touch", required_argument, NULL, OPT_TOUCH},
+	{"help", no_argument, NULL, 'h'},
+	{NULL, 0, NULL, 0}
+    };
+    char *end;
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -153,8 +351,61 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "gf:t:avVh")) != EOF) {
+    while ((c = getopt_long(argc, argv, "b:cgf:j:l:t:m:s:P:T:u:CFLnRSpavVh",
+			    longopts, NULL)) != EOF) {
         switch (c) {
+	case OPT_FORMAT: /* Write machine-readable results */
+	    if (!strcmp(optarg, "json"))
+		format = FORMAT_JSON;
+	    else if (!strcmp(optarg, "csv"))
+		format = FORMAT_CSV;
+	    else {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case OPT_OUTPUT: /* File for the machine-readable results */
+	    output = optarg;
+	    break;
+	case OPT_COMPARE: /* Compare with results saved by --format=json */
+	    baseline = optarg;
+	    break;
+	case OPT_THRESHOLD: /* Regression threshold for --compare, in % */
+	    threshold = strtod(optarg, &end);
+	    if (*end != '\0' || threshold < 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case OPT_TOUCH: /* Also time the replay with payloads touched */
+	    if (!strcmp(optarg, "line"))
+		touch = TOUCH_LINE;
+	    else if (!strcmp(optarg, "full"))
+		touch = TOUCH_FULL;
+	    else {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'b': /* Benchmark mode: warmup runs, CI target in %, max runs */
+	    warmup = strtol(optarg, &end, 10);
+	    rel_ci = (*end == ',') ? strtod(end + 1, &end) : 1;
+	    max_runs = (*end == ',') ? strtol(end + 1, &end, 10)
+		: BENCH_MAX_RUNS;
+	    if (*end != '\0' || warmup < 0 || rel_ci <= 0 ||
+		max_runs < BENCH_MIN_RUNS) {
+		usage();
+		exit(1);
+	    }
+	    set_fsecs_bench(warmup, rel_ci / 100, max_runs);
+	    bench = 1;
+	    break;
+	case 'C': /* Time libc malloc again instead of using the cache */
+	    recalibrate = 1;
+	    break;
+	case 'c': /* Count hardware events with perf_event_open */
+	    use_counters = 1;
+	    break;
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
 	    break;
@@ -166,6 +417,27 @@ int main(int argc, char **argv)
             tracefiles[0] = strdup(optarg);
             tracefiles[1] = NULL;
             break;
+	case 'j': /* Evaluate several traces at once in worker processes */
+	    jobs = strtol(optarg, &end, 10);
+	    if (*end != '\0' || jobs < 1) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'l': /* Time single requests, one in every <n> */
+	    lat_every = strtoul(optarg, &end, 10);
+	    if (*end != '\0' || lat_every == 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+	case 'u': /* Sample the heap layout every <n> requests */
+	    frag_every = strtoul(optarg, &end, 10);
+	    if (*end != '\0' || frag_every == 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
 	case 't': /* Directory where the traces are located */
 	    if (num_tracefiles == 1) /* ignore if -f already encountered */
 		break;
@@ -173,6 +445,53 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+	case 'm': /* Maximum size of the simulated heap in MB */
+	    maxheap_mb = strtoul(optarg, &end, 10);
+	    if (*end != '\0' || maxheap_mb == 0) {
+		usage();
+		exit(1);
+	    }
+	    mem_set_maxheap(maxheap_mb << 20);
+	    break;
+	case 's': /* Simulated cost of mem_sbrk: ns per call, ns per page */
+	    sbrk_call_ns = strtod(optarg, &end);
+	    if (*end == ',')
+		sbrk_page_ns = strtod(end + 1, &end);
+	    if (*end != '\0' || sbrk_call_ns < 0 || sbrk_page_ns < 0) {
+		usage();
+		exit(1);
+	    }
+	    mem_set_sbrk_cost(sbrk_call_ns, sbrk_page_ns);
+	    break;
+	case 'P': /* Pin mdriver and its workers to these CPUs */
+	    if (parse_cpus(optarg, &pin) < 0) {
+		usage();
+		exit(1);
+	    }
+	    pinned = 1;
+	    break;
+	case 'R': /* Raise the scheduling priority */
+	    raise_priority = 1;
+	    break;
+	case 'L': /* Prefault the heap and lock it in memory */
+	    lock_heap = 1;
+	    break;
+	case 'T': /* Timing method */
+	    timer = optarg;
+	    break;
+	case 'F': /* Regrow the heap from fresh pages on every run */
+	    mem_set_fresh_pages(1);
+	    fresh = 1;
+	    break;
+	case 'S': /* Decode traces while replaying them */
+	    stream = 1;
+	    break;
+	case 'n': /* Measure the driver's overhead with a null allocator */
+	    calibrate = 1;
+	    break;
+	case 'p': /* Fill payloads with position-dependent patterns */
+	    pos_pattern = 1;
+	    break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
@@ -190,6 +509,17 @@ int main(int argc, char **argv)
             exit(1);
         }
     }
+
+    /*
+     * When the machine-readable results go to stdout, keep stdout for
+     * them alone and send everything else that is printed to stderr
+     */
+    if (format != FORMAT_NONE && output == NULL) {
+	if ((fd = dup(STDOUT_FILENO)) < 0 || (out = fdopen(fd, "w")) == NULL ||
+	    dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+	    unix_error("Could not set stdout aside for the results");
+	setvbuf(stdout, NULL, _IOLBF, 0);
+    }
 	
     /* 
      * Check and print team info 
@@ -227,8 +557,46 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    /* Locked pages can't be replaced by fresh ones */
+    if (lock_heap && fresh) {
+	printf("ERROR: -F and -L cannot be used together.\n");
+	exit(1);
+    }
+
+    /*
+     * Steady the machine before anything is calibrated or timed: pin to
+     * the chosen CPUs, which -j workers then divide among themselves,
+     * and raise our priority. The workers inherit both.
+     */
+    if (pinned && sched_setaffinity(0, sizeof(pin), &pin) < 0)
+	unix_error("sched_setaffinity failed in main");
+    if (raise_priority && setpriority(PRIO_PROCESS, 0, -20) < 0)
+	printf("Warning: could not raise the priority: %s\n",
+	       strerror(errno));
+    get_host(&host);
+    if (verbose || pinned || raise_priority || lock_heap)
+	printhost(&host);
+
+    /* The libc times of the traces that were timed on this CPU before */
+    if ((libc_ref = calloc(num_tracefiles, sizeof(libc_ref_t))) == NULL)
+	unix_error("libc_ref calloc in main failed");
+    snprintf(method, MAXLINE, "%s%s", timer, bench ? ",bench" : "");
+    if (!recalibrate)
+	load_libc_cache(host.cpu, method, tracefiles, num_tracefiles);
+
     /* Initialize the timing package */
-    init_fsecs();
+    if (init_fsecs(timer) < 0) {
+	printf("ERROR: Timing method \"%s\" is not available.\n", timer);
+	exit(1);
+    }
+    set_fsecs_stall(speed_stall);
+    if (lat_every)
+	lat_init();
+
+    /* Choose the payload fill and check kernels */
+    payload_init();
+    if (verbose > 1)
+	printf("Checking payloads with the %s kernels.\n", payload_kernel());
 
     /*
      * Always run and evaluate the student's mm package
@@ -241,28 +609,18 @@ int main(int argc, char **argv)
     if (mm_stats == NULL)
 	unix_error("mm_stats calloc in main failed");
     
-    /* Initialize the simulated memory system in memlib.c */
-    mem_init(); 
-
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
+    if (jobs > 1 && num_tracefiles > 1)
+	eval_parallel(tracefiles, num_tracefiles, jobs, stream, mm_stats);
+    else {
+	/* Initialize the simulated memory system in memlib.c */
+	init_heap();
+	init_shadow(&shadow);
+
+	for (i=0; i < num_tracefiles; i++)
+	    eval_trace(tracefiles[i], i, stream, &shadow, &mm_stats[i]);
     }
+    save_libc_cache(host.cpu, method, tracefiles, num_tracefiles, mm_stats);
 
     /* Display the mm results in a compact table */
     if (verbose) {
@@ -270,6 +628,18 @@ int main(int argc, char **argv)
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
     }
+    if (bench) {
+	printbench(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (touch != TOUCH_NONE) {
+	printtouch(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (calibrate) {
+	printnull(num_tracefiles, mm_stats);
+	printf("\n");
+    }
 
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
@@ -277,9 +647,11 @@ int main(int argc, char **argv)
     secs = 0;
     ops = 0;
     util = 0;
+    libc_secs = 0;
     numcorrect = 0;
     for (i=0; i < num_tracefiles; i++) {
 	secs += mm_stats[i].secs;
+	libc_secs += mm_stats[i].libc_secs;
 	ops += mm_stats[i].ops;
 	util += mm_stats[i].util;
 	if (mm_stats[i].valid)
@@ -292,14 +664,18 @@ int main(int argc, char **argv)
      */
     if (errors == 0) {
 	avg_mm_throughput = ops/secs;
+	libc_thruput = ops/libc_secs;
+	if (verbose)
+	    printf("Throughput reference: libc malloc at %.0f Kops\n",
+		   libc_thruput/1e3);
 
 	p1 = UTIL_WEIGHT * avg_mm_util;
-	if (avg_mm_throughput > AVG_LIBC_THRUPUT) {
+	if (avg_mm_throughput > libc_thruput) {
 	    p2 = (double)(1.0 - UTIL_WEIGHT);
 	} 
 	else {
 	    p2 = ((double) (1.0 - UTIL_WEIGHT)) * 
-		(avg_mm_throughput/AVG_LIBC_THRUPUT);
+		(avg_mm_throughput/libc_thruput);
 	}
 	
 	perfindex = (p1 + p2)*100.0;
@@ -319,27 +695,111 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
-    exit(0);
+    /* Write the results for other programs to read */
+    if (format != FORMAT_NONE) {
+	if (output != NULL && (out = fopen(output, "w")) == NULL) {
+	    sprintf(msg, "Could not open %s", output);
+	    unix_error(msg);
+	}
+	write_results(out, format, tracefiles, num_tracefiles, mm_stats,
+		      perfindex, timer);
+	fclose(out);
+    }
+
+    /* Fail if any trace got significantly worse than the baseline */
+    if (baseline != NULL)
+	regressions = compare_results(baseline, tracefiles, num_tracefiles,
+				      mm_stats, threshold);
+    exit(regressions > 0 ? 2 : 0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
- * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * The following routines manipulate the shadow map, which keeps
+ * track of the extent of every allocated block payload. We use the
+ * shadow map to detect any overlapping allocated blocks. Adding or
+ * removing a payload costs time proportional to its size, not to
+ * the number of live blocks, and the bitmap is scanned a word at
+ * a time.
  ****************************************************************/
 
+#define WORD_BITS (8 * sizeof(unsigned long))
+
+/* Granule of the shadow map that holds heap address p */
+#define GRANULE(s, p) ((size_t)((char *)(p) - (s)->base) / ALIGNMENT)
+
+/*
+ * init_shadow - allocate a shadow map that covers the largest heap
+ *     that memlib can hand out
+ */
+static void init_shadow(shadow_t *shadow)
+{
+    size_t granules = (mem_maxheap() + ALIGNMENT - 1) / ALIGNMENT;
+
+    shadow->base = mem_heap_lo();
+    shadow->nwords = (granules + WORD_BITS - 1) / WORD_BITS;
+    shadow->hiword = 0;
+    shadow->bits = calloc(shadow->nwords, sizeof(unsigned long));
+    if (shadow->bits == NULL)
+	unix_error("calloc error in init_shadow");
+}
+
+/*
+ * shadow_find - return the first granule in [g0, g1] whose bit is set,
+ *     or (size_t)-1 if there is none
+ */
+static size_t shadow_find(shadow_t *shadow, size_t g0, size_t g1)
+{
+    size_t w = g0 / WORD_BITS;
+    size_t wlast = g1 / WORD_BITS;
+    unsigned long mask = ~0UL << (g0 % WORD_BITS);
+    unsigned long word;
+
+    for (;; w++, mask = ~0UL) {
+	if (w == wlast)
+	    mask &= ~0UL >> (WORD_BITS - 1 - g1 % WORD_BITS);
+	if ((word = shadow->bits[w] & mask) != 0)
+	    return w * WORD_BITS + __builtin_ctzl(word);
+	if (w == wlast)
+	    return (size_t)-1;
+    }
+}
+
+/*
+ * shadow_mark - set (if set is nonzero) or clear the bits of the
+ *     granules in [g0, g1]
+ */
+static void shadow_mark(shadow_t *shadow, size_t g0, size_t g1, int set)
+{
+    size_t w = g0 / WORD_BITS;
+    size_t wlast = g1 / WORD_BITS;
+    unsigned long mask = ~0UL << (g0 % WORD_BITS);
+
+    if (set && wlast >= shadow->hiword)
+	shadow->hiword = wlast + 1;
+    for (;; w++, mask = ~0UL) {
+	if (w == wlast)
+	    mask &= ~0UL >> (WORD_BITS - 1 - g1 % WORD_BITS);
+	if (set)
+	    shadow->bits[w] |= mask;
+	else
+	    shadow->bits[w] &= ~mask;
+	if (w == wlast)
+	    return;
+    }
+}
+
 /*
- * add_range - As directed by request opnum in trace tracenum,
+ * add_range - As directed by the request on line linenum of trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we mark its granules in the shadow map.
  */
-static int add_range(range_t **ranges, char *lo, int size, 
-		     int tracenum, int opnum)
+static int add_range(shadow_t *shadow, char *lo, int size, 
+		     int tracenum, int linenum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    size_t g;
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -348,7 +808,7 @@ static int add_range(range_t **ranges, char *lo, int size,
     if (!IS_ALIGNED(lo)) {
 	sprintf(msg, "Payload address (%p) not aligned to %d bytes", 
 		lo, ALIGNMENT);
-        malloc_error(tracenum, opnum, msg);
+        malloc_error(tracenum, linenum, msg);
         return 0;
     }
 
@@ -357,173 +817,43 @@ static int add_range(range_t **ranges, char *lo, int size,
 	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
-	malloc_error(tracenum, opnum, msg);
+	malloc_error(tracenum, linenum, msg);
         return 0;
     }
 
     /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    g = shadow_find(shadow, GRANULE(shadow, lo), GRANULE(shadow, hi));
+    if (g != (size_t)-1) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload at %p\n",
+		lo, hi, shadow->base + g * ALIGNMENT);
+	malloc_error(tracenum, linenum, msg);
+	return 0;
     }
 
-    /* 
-     * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
-     */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
-    p->lo = lo;
-    p->hi = hi;
-    *ranges = p;
+    /* Everything looks OK, so remember the extent of this block */
+    shadow_mark(shadow, GRANULE(shadow, lo), GRANULE(shadow, hi), 1);
     return 1;
 }
 
 /* 
- * remove_range - Free the range record of block whose payload starts at lo 
- *
- * XXX alc: It's unclear what the variable "size" was used for.
- */
-static void remove_range(range_t **ranges, char *lo)
-{
-    range_t *p;
-    range_t **prevpp = ranges;
-    //int size;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            //size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
-    }
-}
-
-/*
- * clear_ranges - free all of the range records for a trace 
+ * remove_range - Clear the shadow bits of the size-byte payload at lo
  */
-static void clear_ranges(range_t **ranges)
+static void remove_range(shadow_t *shadow, char *lo, int size)
 {
-    range_t *p;
-    range_t *pnext;
-
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
-    *ranges = NULL;
+    shadow_mark(shadow, GRANULE(shadow, lo),
+		GRANULE(shadow, lo + size - 1), 0);
 }
 
-
-/**********************************************
- * The following routines manipulate tracefiles
- *********************************************/
-
 /*
- * read_trace - read a trace file and store it in memory
+ * clear_ranges - clear the shadow map for a new trace, touching only
+ *     the words that were set by the last one
  */
-static trace_t *read_trace(char *tracedir, char *filename)
+static void clear_ranges(shadow_t *shadow)
 {
-    FILE *tracefile;
-    trace_t *trace;
-    char type[MAXLINE];
-    char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
-
-    if (verbose > 1)
-	printf("Reading tracefile: %s\n", filename);
-
-    /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-	unix_error("malloc 1 failed in read_trance");
-	
-    /* Read the trace file header */
-    strcpy(path, tracedir);
-    strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
-    }
-    fscanf(tracefile, "%u", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%u", &(trace->num_ids));     
-    fscanf(tracefile, "%u", &(trace->num_ops));     
-    fscanf(tracefile, "%u", &(trace->weight));        /* not used */
-    
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
-
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
-    
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'f':
-	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
-	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
-	    exit(1);
-	}
-	op_index++;
-	
-    }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-    
-    return trace;
+    memset(shadow->bits, 0, shadow->hiword * sizeof(unsigned long));
+    shadow->hiword = 0;
 }
 
-/*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
- */
-void free_trace(trace_t *trace)
-{
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);      
-    free(trace->block_sizes);
-    free(trace);              /* and the trace record itself... */
-}
 
 /**********************************************************************
  * The following functions evaluate the correctness, space utilization,
@@ -533,110 +863,119 @@ void free_trace(trace_t *trace)
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
+static int eval_mm_valid(trace_t *trace, int tracenum, shadow_t *shadow) 
 {
-    unsigned i, j;
+    unsigned i, n, base;
     int index;
     unsigned size;
     unsigned oldsize;
+    int line;
+    traceop_t *ops;
     char *newp;
     char *oldp;
     char *p;
     
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and clear the shadow map */
     mem_reset_brk();
-    clear_ranges(ranges);
+    clear_ranges(shadow);
 
     /* Call the mm package's init function */
     if (mm_init() < 0) {
-	malloc_error(tracenum, 0, "mm_init failed.");
+	malloc_error(tracenum, LINENUM(trace, 0), "mm_init failed.");
 	return 0;
     }
 
     /* Interpret each operation in the trace in order */
-    for (i = 0;  i < trace->num_ops;  i++) {
-	index = trace->ops[i].index;
-	size = trace->ops[i].size;
-
-        switch (trace->ops[i].type) {
-
-        case ALLOC: /* mm_malloc */
-
-	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
-		malloc_error(tracenum, i, "mm_malloc failed.");
-		return 0;
-	    }
+    trace_rewind(trace);
+    for (base = 0; (n = trace_next_chunk(trace, &ops)) > 0; base += n) {
+	for (i = 0;  i < n;  i++) {
+	    index = ops[i].index;
+	    size = ops[i].size;
+	    line = LINENUM(trace, base + i);
+
+	    /* Binary traces are not checked when read, so check here */
+	    if ((unsigned)index >= trace->num_ids)
+		app_error("Request id out of range in eval_mm_valid");
+
+	    switch (ops[i].type) {
+
+	    case ALLOC: /* mm_malloc */
+
+		/* Call the student's malloc */
+		if ((p = mm_malloc(size)) == NULL) {
+		    malloc_error(tracenum, line, "mm_malloc failed.");
+		    return 0;
+		}
 	    
-	    /* 
-	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
-	     * and must not overlap any currently allocated block. 
-	     */ 
-	    if (add_range(ranges, p, size, tracenum, i) == 0)
-		return 0;
+		/* 
+		 * Test the range of the new block for correctness and add
+		 * it to the shadow map if OK. The block must be  be aligned
+		 * properly, and must not overlap any currently allocated
+		 * block.
+		 */ 
+		if (add_range(shadow, p, size, tracenum, line) == 0)
+		    return 0;
 	    
-	    /* ADDED: cgw
-	     * fill range with low byte of index.  This will be used later
-	     * if we realloc the block and wish to make sure that the old
-	     * data was copied to the new block
-	     */
-	    memset(p, index & 0xFF, size);
-
-	    /* Remember region */
-	    trace->blocks[index] = p;
-	    trace->block_sizes[index] = size;
-	    break;
+		/* ADDED: cgw
+		 * fill range with a pattern derived from index.  This will be
+		 * used later if we realloc the block and wish to make sure
+		 * that the old data was copied to the new block
+		 */
+		payload_fill(p, 0, size, index, STEP(index));
+
+		/* Remember region */
+		trace->blocks[index] = p;
+		trace->block_sizes[index] = size;
+		break;
 
-        case REALLOC: /* mm_realloc */
+	    case REALLOC: /* mm_realloc */
 	    
-	    /* Call the student's realloc */
-	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp, size)) == NULL) {
-		malloc_error(tracenum, i, "mm_realloc failed.");
-		return 0;
-	    }
+		/* Call the student's realloc */
+		oldp = trace->blocks[index];
+		if ((newp = mm_realloc(oldp, size)) == NULL) {
+		    malloc_error(tracenum, line, "mm_realloc failed.");
+		    return 0;
+		}
 	    
-	    /* Remove the old region from the range list */
-	    remove_range(ranges, oldp);
+		/* Remove the old region from the shadow map */
+		remove_range(shadow, oldp, trace->block_sizes[index]);
 	    
-	    /* Check new block for correctness and add it to range list */
-	    if (add_range(ranges, newp, size, tracenum, i) == 0)
-		return 0;
+		/* Check new block for correctness and add it to shadow map */
+		if (add_range(shadow, newp, size, tracenum, line) == 0)
+		    return 0;
 	    
-	    /* ADDED: cgw
-	     * Make sure that the new block contains the data from the old 
-	     * block and then fill in the new block with the low order byte
-	     * of the new index
-	     */
-	    oldsize = trace->block_sizes[index];
-	    if (size < oldsize) oldsize = size;
-	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
-		malloc_error(tracenum, i, "mm_realloc did not preserve the "
-			     "data from old block");
-		return 0;
-	      }
-	    }
-	    memset(newp, index & 0xFF, size);
-
-	    /* Remember region */
-	    trace->blocks[index] = newp;
-	    trace->block_sizes[index] = size;
-	    break;
+		/* ADDED: cgw
+		 * Make sure that the new block contains the data from the old 
+		 * block and then fill in the rest of the new block, which
+		 * continues the same pattern
+		 */
+		oldsize = trace->block_sizes[index];
+		if (size < oldsize) oldsize = size;
+		if (payload_check(newp, oldsize, index, STEP(index)) < oldsize) {
+		    malloc_error(tracenum, line, "mm_realloc did not preserve the "
+				 "data from old block");
+		    return 0;
+		}
+		payload_fill(newp, oldsize, size, index, STEP(index));
+
+		/* Remember region */
+		trace->blocks[index] = newp;
+		trace->block_sizes[index] = size;
+		break;
 
-        case FREE: /* mm_free */
+	    case FREE: /* mm_free */
 	    
-	    /* Remove region from list and call student's free function */
-	    p = trace->blocks[index];
-	    remove_range(ranges, p);
-	    mm_free(p);
-	    break;
+		/* Remove region from map and call student's free function */
+		p = trace->blocks[index];
+		remove_range(shadow, p, trace->block_sizes[index]);
+		mm_free(p);
+		break;
 
-	default:
-	    app_error("Nonexistent request type in eval_mm_valid");
-        }
+	    default:
+		app_error("Nonexistent request type in eval_mm_valid");
+	    }
 
+	}
     }
 
     /* As far as we know, this is a valid malloc package */
@@ -652,13 +991,21 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   package on the trace. Note that our implementation of mem_sbrk() 
  *   doesn't allow the students to decrement the brk pointer, so brk
  *   is always the high water mark of the heap. 
- *   
+ *
+ *   The ratio hwm/peak resident heap bytes is also returned in *rss_util.
+ *   It charges the package only for the heap pages it actually touched.
+ *
+ *   If samples is not NULL, the layout of the heap is also recorded there
+ *   every frag_every requests and after the last one (-u), and the number
+ *   of samples taken is returned in *num_samples.
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, double *rss_util,
+			   heapsample_t *samples, unsigned *num_samples)
 {   
-    unsigned i;
+    unsigned i, n, base, ns = 0;
     int index;
     unsigned size, newsize, oldsize;
+    traceop_t *ops;
     int max_total_size = 0;
     int total_size = 0;
     char *p;
@@ -666,192 +1013,1896 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 
     /* Remove the unused variable warnings */
     (void)tracenum;
-    (void)ranges;
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
+    mem_reset_resident();
     if (mm_init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    trace_rewind(trace);
+    for (base = 0; (n = trace_next_chunk(trace, &ops)) > 0; base += n) {
+	for (i = 0;  i < n;  i++) {
+	    switch (ops[i].type) {
 
-        case ALLOC: /* mm_alloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
+	    case ALLOC: /* mm_alloc */
+		index = ops[i].index;
+		size = ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
-		app_error("mm_malloc failed in eval_mm_util");
+		if ((p = mm_malloc(size)) == NULL) 
+		    app_error("mm_malloc failed in eval_mm_util");
+		touch_pages(p, size);
 	    
-	    /* Remember region and size */
-	    trace->blocks[index] = p;
-	    trace->block_sizes[index] = size;
+		/* Remember region and size */
+		trace->blocks[index] = p;
+		trace->block_sizes[index] = size;
 	    
-	    /* Keep track of current total size
-	     * of all allocated blocks */
-	    total_size += size;
+		/* Keep track of current total size
+		 * of all allocated blocks */
+		total_size += size;
 	    
-	    /* Update statistics */
-	    max_total_size = (total_size > max_total_size) ?
-		total_size : max_total_size;
-	    break;
+		/* Update statistics */
+		max_total_size = (total_size > max_total_size) ?
+		    total_size : max_total_size;
+		break;
 
-	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
-	    oldsize = trace->block_sizes[index];
+	    case REALLOC: /* mm_realloc */
+		index = ops[i].index;
+		newsize = ops[i].size;
+		oldsize = trace->block_sizes[index];
 
-	    oldp = trace->blocks[index];
-	    if ((newp = mm_realloc(oldp,newsize)) == NULL)
-		app_error("mm_realloc failed in eval_mm_util");
+		oldp = trace->blocks[index];
+		if ((newp = mm_realloc(oldp,newsize)) == NULL)
+		    app_error("mm_realloc failed in eval_mm_util");
+		touch_pages(newp, newsize);
 
-	    /* Remember region and size */
-	    trace->blocks[index] = newp;
-	    trace->block_sizes[index] = newsize;
+		/* Remember region and size */
+		trace->blocks[index] = newp;
+		trace->block_sizes[index] = newsize;
 	    
-	    /* Keep track of current total size
-	     * of all allocated blocks */
-	    total_size += (newsize - oldsize);
+		/* Keep track of current total size
+		 * of all allocated blocks */
+		total_size += (newsize - oldsize);
 	    
-	    /* Update statistics */
-	    max_total_size = (total_size > max_total_size) ?
-		total_size : max_total_size;
-	    break;
+		/* Update statistics */
+		max_total_size = (total_size > max_total_size) ?
+		    total_size : max_total_size;
+		break;
 
-        case FREE: /* mm_free */
-	    index = trace->ops[i].index;
-	    size = trace->block_sizes[index];
-	    p = trace->blocks[index];
+	    case FREE: /* mm_free */
+		index = ops[i].index;
+		size = trace->block_sizes[index];
+		p = trace->blocks[index];
 	    
-	    mm_free(p);
+		mm_free(p);
 	    
-	    /* Keep track of current total size
-	     * of all allocated blocks */
-	    total_size -= size;
+		/* Keep track of current total size
+		 * of all allocated blocks */
+		total_size -= size;
 	    
-	    break;
+		break;
 
-	default:
-	    app_error("Nonexistent request type in eval_mm_util");
+	    default:
+		app_error("Nonexistent request type in eval_mm_util");
 
-        }
+	    }
+	    if (samples != NULL && (base + i + 1) % frag_every == 0)
+		sample_heap(&samples[ns++], base + i + 1, total_size);
+	}
+    }
+    if (samples != NULL) {
+	if (trace->num_ops % frag_every != 0)
+	    sample_heap(&samples[ns++], trace->num_ops, total_size);
+	*num_samples = ns;
     }
 
+    *rss_util = (double)max_total_size / (double)mem_peak_resident_bytes();
     return ((double)max_total_size / (double)mem_heapsize());
 }
 
 
+/*
+ * replay_speed - Replay a trace against an allocator, for eval_mm_speed
+ *    and eval_null_speed. It is always inlined, so that each caller gets
+ *    its own copy of the loop that calls its allocator directly, and the
+ *    two copies do the same work around those calls.
+ */
+static inline __attribute__((always_inline)) void
+replay_speed(speed_t *params, void *(*alloc)(size_t),
+	     void (*dealloc)(void *), void *(*resize)(void *, size_t))
+{
+    unsigned i, n, base, index, size, newsize;
+    char *p, *newp, *oldp, *block;
+    traceop_t *ops;
+    trace_t *trace = params->trace;
+    int touch = params->touch;
+    unsigned long sum = 0;
+
+    /* Interpret each trace request */
+    trace_rewind(trace);
+    for (base = 0; (n = trace_next_chunk(trace, &ops)) > 0; base += n)
+	for (i = 0;  i < n;  i++)
+	    switch (ops[i].type) {
+
+	    case ALLOC: /* mm_malloc */
+		index = ops[i].index;
+		size = ops[i].size;
+		if ((p = alloc(size)) == NULL)
+		    app_error("mm_malloc error in eval_mm_speed");
+		trace->blocks[index] = p;
+		if (touch) {
+		    write_payload(p, size, touch);
+		    trace->block_sizes[index] = size;
+		}
+		break;
+
+	    case REALLOC: /* mm_realloc */
+		index = ops[i].index;
+		newsize = ops[i].size;
+		oldp = trace->blocks[index];
+		if ((newp = resize(oldp,newsize)) == NULL)
+		    app_error("mm_realloc error in eval_mm_speed");
+		trace->blocks[index] = newp;
+		if (touch) {
+		    write_payload(newp, newsize, touch);
+		    trace->block_sizes[index] = newsize;
+		}
+		break;
+
+	    case FREE: /* mm_free */
+		index = ops[i].index;
+		block = trace->blocks[index];
+		if (touch)
+		    sum += read_payload(block, trace->block_sizes[index], touch);
+		dealloc(block);
+		break;
+
+	    default:
+		app_error("Nonexistent request type in eval_mm_valid");
+	    }
+    touch_sink += sum;
+}
+
+/*
+ * DEFINE_REPLAY_PACKED - Define a function that replays a packed trace
+ *    (see trace_pack) against an allocator, like replay_speed but
+ *    faster. Each request's word says where to jump next, so dispatch
+ *    is one indirect branch per request, which the branch predictor
+ *    learns per request type, and the PACK_END word ends the loop
+ *    without a bounds check. GCC will not inline a function that
+ *    contains a computed goto, so this is a macro instead.
+ */
+#define DEFINE_REPLAY_PACKED(name, alloc, dealloc, resize)		\
+static void name(trace_t *trace)					\
+{									\
+    static void *dispatch[] = {						\
+	[ALLOC] = &&do_alloc,						\
+	[FREE] = &&do_free,						\
+	[REALLOC] = &&do_realloc,					\
+	[PACK_END >> PACK_TYPE_SHIFT] = &&done				\
+    };									\
+    uint32_t *op = trace->packed;					\
+    uint32_t *size = trace->packed_sizes;				\
+    char **blocks = trace->blocks;					\
+    uint32_t w;								\
+    char *p;								\
+									\
+    w = *op++;								\
+    goto *dispatch[w >> PACK_TYPE_SHIFT];				\
+									\
+ do_alloc:								\
+    if ((p = alloc(*size++)) == NULL)					\
+	app_error("mm_malloc error in " #name);				\
+    blocks[w & PACK_ID_MASK] = p;					\
+    w = *op++;								\
+    goto *dispatch[w >> PACK_TYPE_SHIFT];				\
+									\
+ do_free:								\
+    dealloc(blocks[w & PACK_ID_MASK]);					\
+    w = *op++;								\
+    goto *dispatch[w >> PACK_TYPE_SHIFT];				\
+									\
+ do_realloc:								\
+    if ((p = resize(blocks[w & PACK_ID_MASK], *size++)) == NULL)	\
+	app_error("mm_realloc error in " #name);			\
+    blocks[w & PACK_ID_MASK] = p;					\
+    w = *op++;								\
+    goto *dispatch[w >> PACK_TYPE_SHIFT];				\
+									\
+ done:									\
+    return;								\
+}
+
+DEFINE_REPLAY_PACKED(replay_packed_mm, mm_malloc, mm_free, mm_realloc)
+DEFINE_REPLAY_PACKED(replay_packed_null, null_malloc, null_free, null_realloc)
+DEFINE_REPLAY_PACKED(replay_packed_libc, malloc, free, realloc)
+
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
  */
 static void eval_mm_speed(void *ptr)
 {
-    unsigned i, index, size, newsize;
-    char *p, *newp, *oldp, *block;
-    trace_t *trace = ((speed_t *)ptr)->trace;
+    speed_t *params = ptr;
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
     if (mm_init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
-    /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
-
-        case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
-		app_error("mm_malloc error in eval_mm_speed");
-            trace->blocks[index] = p;
-            break;
+    /* Payloads are only touched by the general loop */
+    if (params->trace->packed != NULL && params->touch == TOUCH_NONE)
+	replay_packed_mm(params->trace);
+    else
+	replay_speed(params, mm_malloc, mm_free, mm_realloc);
+}
 
-	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
-		app_error("mm_realloc error in eval_mm_speed");
-            trace->blocks[index] = newp;
-            break;
+/*
+ * null_malloc, null_free, null_realloc - A trivial allocator that only
+ *    bumps an address and never reuses or even touches memory, so that
+ *    replaying a trace against it costs the driver's own work and the
+ *    calls, and nothing else. The addresses it returns are never
+ *    dereferenced, since eval_null_speed does not touch payloads. The
+ *    functions are kept out of line, as the mm package's are.
+ */
+static __attribute__((noinline)) void *null_malloc(size_t size)
+{
+    uintptr_t p = null_brk;
 
-        case FREE: /* mm_free */
-            index = trace->ops[i].index;
-            block = trace->blocks[index];
-            mm_free(block);
-            break;
+    null_brk += (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    return (void *)p;
+}
 
-	default:
-	    app_error("Nonexistent request type in eval_mm_valid");
-        }
+static __attribute__((noinline)) void null_free(void *ptr)
+{
+    (void)ptr;
 }
 
-/*************************************
- * Some miscellaneous helper routines
- ************************************/
+static __attribute__((noinline)) void *null_realloc(void *ptr, size_t size)
+{
+    (void)ptr;
+    return null_malloc(size);
+}
+
+/*
+ * eval_null_speed - Like eval_mm_speed, but replays the trace against
+ *    the null allocator, to measure how much of eval_mm_speed's time
+ *    is the driver's (-n)
+ */
+static void eval_null_speed(void *ptr)
+{
+    speed_t *params = ptr;
 
+    null_brk = ALIGNMENT;
+    if (params->trace->packed != NULL && params->touch == TOUCH_NONE)
+	replay_packed_null(params->trace);
+    else
+	replay_speed(params, null_malloc, null_free, null_realloc);
+}
 
 /*
- * printresults - prints a performance summary for some malloc package
+ * eval_libc_speed - Like eval_mm_speed, but for the libc malloc
+ *    package, which sets the throughput that the mm package is graded
+ *    against. The blocks that the trace never frees are freed
+ *    afterwards, so that repeated runs don't leak them.
  */
-static void printresults(int n, stats_t *stats) 
+static void eval_libc_speed(void *ptr)
 {
-    int i;
-    double secs = 0;
-    double ops = 0;
-    double util = 0;
+    speed_t *params = ptr;
+    unsigned i;
 
-    /* Print the individual results for each trace */
-    /* All the space before the last number on each line is added by 
-     * Zheng Cai, for better formatting */
-    printf("%5s%7s %5s%8s%10s %6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
-    for (i=0; i < n; i++) {
-	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f %6.0f\n", 
-		   i,
-		   "yes",
-		   stats[i].util*100.0,
-		   stats[i].ops,
-		   stats[i].secs,
-		   (stats[i].ops/1e3)/stats[i].secs);
-	    secs += stats[i].secs;
-	    ops += stats[i].ops;
-	    util += stats[i].util;
-	}
-	else {
-	    printf("%2d%10s%6s%8s%10s %6s\n", 
-		   i,
-		   "no",
-		   "-",
-		   "-",
-		   "-",
-		   "-");
-	}
-    }
+    if (params->trace->packed != NULL)
+	replay_packed_libc(params->trace);
+    else
+	replay_speed(params, malloc, free, realloc);
+    for (i = 0; i < params->num_leftover; i++)
+	free(params->trace->blocks[params->leftover[i]]);
+}
 
-    /* Print the aggregate results for the set of traces */
-    if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f %6.0f\n", 
-	       "Total       ",
-	       (util/n)*100.0,
-	       ops, 
-	       secs,
-	       (ops/1e3)/secs);
-    }
+/*
+ * eval_libc_threads - Like eval_libc_speed, but for a threaded trace,
+ *    which is replayed by the same threads as in eval_mm_threads
+ */
+static void eval_libc_threads(void *ptr)
+{
+    speed_t *params = ptr;
+    unsigned i;
+
+    memset(params->gen, 0, params->trace->num_ids * sizeof(unsigned));
+    params->libc = 1;
+    pthread_barrier_wait(&params->start);
+    pthread_barrier_wait(&params->finish);
+    for (i = 0; i < params->num_leftover; i++)
+	free(params->trace->blocks[params->leftover[i]]);
+}
+
+/*
+ * find_leftovers - Find the blocks that are still allocated at the end
+ *    of a trace, for eval_libc_speed and eval_libc_threads to free
+ */
+static void find_leftovers(trace_t *trace, speed_t *params)
+{
+    unsigned i, n, id;
+    traceop_t *ops;
+    char *live;
+
+    if ((live = calloc(trace->num_ids, 1)) == NULL)
+	unix_error("calloc failed in find_leftovers");
+    trace_rewind(trace);
+    while ((n = trace_next_chunk(trace, &ops)) > 0)
+	for (i = 0; i < n; i++)
+	    live[ops[i].index] = (ops[i].type != FREE);
+
+    params->num_leftover = 0;
+    for (id = 0; id < trace->num_ids; id++)
+	params->num_leftover += live[id];
+    if ((params->leftover = malloc((params->num_leftover + 1) *
+				   sizeof(unsigned))) == NULL)
+	unix_error("malloc failed in find_leftovers");
+    for (id = 0, n = 0; id < trace->num_ids; id++)
+	if (live[id])
+	    params->leftover[n++] = id;
+    free(live);
+}
+
+/*
+ * write_payload, read_payload - Store to a new payload, and load from
+ *    one that is about to be freed, as the application would: only the
+ *    first cache line of it with --touch=line, all of it with
+ *    --touch=full. read_payload returns the sum of the words it loaded,
+ *    so that the loads cannot be optimized away.
+ */
+static inline void write_payload(char *p, unsigned size, int touch)
+{
+    if (touch == TOUCH_LINE && size > CACHE_LINE)
+	size = CACHE_LINE;
+    memset(p, 0x5a, size);
+}
+
+static inline unsigned long read_payload(char *p, unsigned size, int touch)
+{
+    unsigned long sum = 0, w;
+    unsigned j;
+
+    if (touch == TOUCH_LINE && size > CACHE_LINE)
+	size = CACHE_LINE;
+    for (j = 0; j + sizeof(w) <= size; j += sizeof(w)) {
+	memcpy(&w, p + j, sizeof(w));
+	sum += w;
+    }
+    for (; j < size; j++)
+	sum += (unsigned char)p[j];
+    return sum;
+}
+
+/*
+ * replay_request - Make one request of the mm package on behalf of
+ *    eval_mm_latency
+ */
+static inline void replay_request(trace_t *trace, traceop_t *op)
+{
+    char *p;
+
+    switch (op->type) {
+
+    case ALLOC: /* mm_malloc */
+	if ((p = mm_malloc(op->size)) == NULL)
+	    app_error("mm_malloc error in eval_mm_latency");
+	trace->blocks[op->index] = p;
+	break;
+
+    case REALLOC: /* mm_realloc */
+	if ((p = mm_realloc(trace->blocks[op->index], op->size)) == NULL)
+	    app_error("mm_realloc error in eval_mm_latency");
+	trace->blocks[op->index] = p;
+	break;
+
+    case FREE: /* mm_free */
+	mm_free(trace->blocks[op->index]);
+	break;
+
+    default:
+	app_error("Nonexistent request type in eval_mm_latency");
+    }
+}
+
+/*
+ * eval_mm_latency - Replay a trace once, timing single requests of the
+ *    mm package, and record their latencies in ticks, less the timer
+ *    overhead, in one histogram per request type. With -l <n> only a
+ *    random one in n requests is timed. A threaded trace is replayed
+ *    in trace order by this thread alone.
+ */
+static void eval_mm_latency(trace_t *trace, hist_t *hists)
+{
+    unsigned i, n;
+    uint32_t r = 2463534242u;  /* xorshift32 state that picks the samples */
+    uint64_t t0, t1, overhead = lat_overhead();
+    traceop_t *ops;
+
+    for (i = 0; i < 3; i++)
+	hist_clear(&hists[i]);
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_latency");
+
+    trace_rewind(trace);
+    while ((n = trace_next_chunk(trace, &ops)) > 0)
+	for (i = 0; i < n; i++) {
+	    r ^= r << 13;
+	    r ^= r >> 17;
+	    r ^= r << 5;
+	    if (r % lat_every != 0) {
+		replay_request(trace, &ops[i]);
+		continue;
+	    }
+	    t0 = lat_start();
+	    replay_request(trace, &ops[i]);
+	    t1 = lat_stop();
+	    hist_add(&hists[ops[i].type],
+		     t1 - t0 > overhead ? t1 - t0 - overhead : 0);
+	}
+}
+
+/*
+ * eval_mm_counters - Count hardware events during one more run of the
+ *    speed function f, and print the counts for the trace, in total and
+ *    per request
+ */
+static void eval_mm_counters(fsecs_test_funct f, speed_t *params,
+			     int tracenum)
+{
+    perfctr_t pc;
+    double ops = params->trace->num_ops;
+    int i;
+
+    if (perfctr_start() == 0) {
+	perfctr_stop(&pc);
+	printf("Trace %d: no hardware counters (%s)\n",
+	       tracenum, perfctr_error());
+	return;
+    }
+    f(params);
+    perfctr_stop(&pc);
+
+    printf("Trace %d hardware counters, user mode, one replay:\n", tracenum);
+    printf("%14s%14s%10s\n", "counter", "total", "per op");
+    for (i = 0; i < PC_NUM; i++) {
+	if (pc.valid[i])
+	    printf("%14s%14lu%10.2f\n", perfctr_name(i),
+		   (unsigned long)pc.counts[i], pc.counts[i] / ops);
+	else
+	    printf("%14s%14s%10s\n", perfctr_name(i), "-", "-");
+    }
+    if (pc.valid[PC_CYCLES] && pc.valid[PC_INSTRUCTIONS] &&
+	pc.counts[PC_CYCLES] > 0)
+	printf("%14s%14.2f\n", "IPC",
+	       (double)pc.counts[PC_INSTRUCTIONS] / pc.counts[PC_CYCLES]);
+}
+
+/*
+ * When a threaded trace is replayed, calls to the mm package are
+ * serialized with a lock unless it is thread safe (see config.h)
+ */
+#if MM_THREAD_SAFE
+#define MM_LOCK()
+#define MM_UNLOCK()
+#else
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+#define MM_LOCK()   pthread_mutex_lock(&mm_lock)
+#define MM_UNLOCK() pthread_mutex_unlock(&mm_lock)
+#endif
+
+/*
+ * split_threads - Give each thread of a threaded trace its own array
+ *    of requests. A free of a block that another thread allocated
+ *    records in its size field how many allocs and reallocs of the
+ *    block must be done before the free may proceed.
+ */
+static void split_threads(trace_t *trace, speed_t *params)
+{
+    unsigned i, t, n = trace->num_threads;
+    unsigned *owner, *done;
+    replay_t *threads;
+    traceop_t op;
+
+    threads = calloc(n, sizeof(replay_t));
+    params->gen = calloc(trace->num_ids, sizeof(unsigned));
+    owner = malloc(trace->num_ids * sizeof(unsigned));
+    done = calloc(trace->num_ids, sizeof(unsigned));
+    if (!threads || !params->gen || !owner || !done)
+	unix_error("malloc failed in split_threads");
+
+    for (i = 0; i < trace->num_ops; i++)
+	threads[trace->tids[i]].num_ops++;
+    for (t = 0; t < n; t++) {
+	threads[t].params = params;
+	threads[t].secs = DBL_MAX;
+	if ((threads[t].ops = malloc(threads[t].num_ops * sizeof(traceop_t)))
+	    == NULL)
+	    unix_error("malloc failed in split_threads");
+	threads[t].num_ops = 0;
+    }
+
+    for (i = 0; i < trace->num_ops; i++) {
+	t = trace->tids[i];
+	op = trace->ops[i];
+	if (op.type == FREE)
+	    op.size = (owner[op.index] == t) ? 0 : done[op.index];
+	else {
+	    owner[op.index] = t;
+	    done[op.index]++;
+	}
+	threads[t].ops[threads[t].num_ops++] = op;
+    }
+    free(owner);
+    free(done);
+
+    params->threads = threads;
+}
+
+/*
+ * start_threads - Create one thread per trace thread. The threads wait
+ *    at the start barrier, replay their requests when eval_mm_threads or
+ *    eval_libc_threads releases them, and meet it again at the finish
+ *    barrier, so that no thread is created inside a timed run.
+ */
+static void start_threads(speed_t *params)
+{
+    unsigned t, n = params->trace->num_threads;
+
+    if (pthread_barrier_init(&params->start, NULL, n + 1) != 0 ||
+	pthread_barrier_init(&params->finish, NULL, n + 1) != 0)
+	app_error("pthread_barrier_init failed in start_threads");
+    params->quit = 0;
+    for (t = 0; t < n; t++)
+	if (pthread_create(&params->threads[t].thread, NULL, replay_thread,
+			   &params->threads[t]) != 0)
+	    app_error("pthread_create failed in start_threads");
+}
+
+/*
+ * stop_threads - Tell the threads made by start_threads to exit, and
+ *    wait for them
+ */
+static void stop_threads(speed_t *params)
+{
+    unsigned t;
+
+    params->quit = 1;
+    pthread_barrier_wait(&params->start);
+    for (t = 0; t < params->trace->num_threads; t++)
+	pthread_join(params->threads[t].thread, NULL);
+    pthread_barrier_destroy(&params->start);
+    pthread_barrier_destroy(&params->finish);
+}
+
+/*
+ * eval_mm_threads - This is the function that is used by fcyc()
+ *    to measure the running time of the mm malloc package on a
+ *    threaded trace, with one thread per trace thread (see
+ *    start_threads).
+ */
+static void eval_mm_threads(void *ptr)
+{
+    speed_t *params = ptr;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_threads");
+    memset(params->gen, 0, params->trace->num_ids * sizeof(unsigned));
+
+    params->libc = 0;
+    pthread_barrier_wait(&params->start);
+    pthread_barrier_wait(&params->finish);
+}
+
+/*
+ * eval_mm_threads_once - Like eval_mm_threads, but with threads of its
+ *    own, for eval_mm_counters: the counters follow only the threads
+ *    created after they start, and count them in when they exit
+ */
+static void eval_mm_threads_once(void *ptr)
+{
+    start_threads(ptr);
+    eval_mm_threads(ptr);
+    stop_threads(ptr);
+}
+
+/*
+ * mm_malloc_locked, mm_free_locked, mm_realloc_locked - The mm package
+ *    as called by the threads of a threaded trace
+ */
+static void *mm_malloc_locked(size_t size)
+{
+    void *p;
+
+    MM_LOCK();
+    p = mm_malloc(size);
+    MM_UNLOCK();
+    return p;
+}
+
+static void mm_free_locked(void *ptr)
+{
+    MM_LOCK();
+    mm_free(ptr);
+    MM_UNLOCK();
+}
+
+static void *mm_realloc_locked(void *ptr, size_t size)
+{
+    void *p;
+
+    MM_LOCK();
+    p = mm_realloc(ptr, size);
+    MM_UNLOCK();
+    return p;
+}
+
+/*
+ * replay_ops - Replay the requests of one thread of a threaded trace
+ *    against an allocator, and return how long it took. Each block is
+ *    published by bumping its count in gen after it is allocated or
+ *    reallocated; a cross-thread free waits for the count it needs
+ *    before it reads the block's address. Always inlined, like
+ *    replay_speed.
+ */
+static inline __attribute__((always_inline)) double
+replay_ops(replay_t *self, void *(*alloc)(size_t),
+	   void (*dealloc)(void *), void *(*resize)(void *, size_t))
+{
+    trace_t *trace = self->params->trace;
+    unsigned *gen = self->params->gen;
+    traceop_t *ops = self->ops;
+    int touch = self->params->touch;
+    unsigned i, index;
+    unsigned long sum = 0;
+    struct timespec start, stop;
+    char *p;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < self->num_ops; i++) {
+	index = ops[i].index;
+	switch (ops[i].type) {
+
+	case ALLOC: /* malloc */
+	    if ((p = alloc(ops[i].size)) == NULL)
+		app_error("malloc error in replay_thread");
+	    trace->blocks[index] = p;
+	    if (touch) {
+		write_payload(p, ops[i].size, touch);
+		trace->block_sizes[index] = ops[i].size;
+	    }
+	    __atomic_store_n(&gen[index], gen[index] + 1, __ATOMIC_RELEASE);
+	    break;
+
+	case REALLOC: /* realloc */
+	    if ((p = resize(trace->blocks[index], ops[i].size)) == NULL)
+		app_error("realloc error in replay_thread");
+	    trace->blocks[index] = p;
+	    if (touch) {
+		write_payload(p, ops[i].size, touch);
+		trace->block_sizes[index] = ops[i].size;
+	    }
+	    __atomic_store_n(&gen[index], gen[index] + 1, __ATOMIC_RELEASE);
+	    break;
+
+	case FREE: /* free */
+	    while (__atomic_load_n(&gen[index], __ATOMIC_ACQUIRE) <
+		   ops[i].size)
+		sched_yield();
+	    if (touch)
+		sum += read_payload(trace->blocks[index],
+				    trace->block_sizes[index], touch);
+	    dealloc(trace->blocks[index]);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in replay_thread");
+	}
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    __atomic_fetch_add(&touch_sink, sum, __ATOMIC_RELAXED);
+    return (stop.tv_sec - start.tv_sec) + 1e-9 * (stop.tv_nsec - start.tv_nsec);
+}
+
+/*
+ * replay_thread - The body of a thread made by start_threads: replay
+ *    the thread's requests each time the start barrier opens, against
+ *    libc malloc or the mm package, and keep the shortest time of the
+ *    mm package's replays
+ */
+static void *replay_thread(void *arg)
+{
+    replay_t *self = arg;
+    speed_t *params = self->params;
+    double secs;
+
+    for (;;) {
+	pthread_barrier_wait(&params->start);
+	if (params->quit)
+	    break;
+	if (params->libc)
+	    replay_ops(self, malloc, free, realloc);
+	else {
+	    secs = replay_ops(self, mm_malloc_locked, mm_free_locked,
+			      mm_realloc_locked);
+	    if (secs < self->secs)
+		self->secs = secs;
+	}
+	pthread_barrier_wait(&params->finish);
+    }
+    return NULL;
+}
+
+/*
+ * eval_trace - Evaluate the mm package on one trace file: check it for
+ *    correctness, then measure its utilization and speed
+ */
+static void eval_trace(char *tracefile, int tracenum, int stream,
+		       shadow_t *shadow, stats_t *stats)
+{
+    trace_t *trace;
+    speed_t speed_params;
+    unsigned t, ops;
+
+    if (stream)
+	trace = stream_trace(tracedir, tracefile);
+    else
+	trace = read_trace(tracedir, tracefile);
+    stats->ops = trace->num_ops;
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, tracenum, shadow);
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	if (frag_every) {
+	    heapsample_t *samples;
+	    unsigned ns;
+
+	    samples = malloc((trace->num_ops / frag_every + 1) *
+			     sizeof(heapsample_t));
+	    if (samples == NULL)
+		unix_error("malloc failed in eval_trace");
+	    stats->util = eval_mm_util(trace, tracenum, &stats->rss_util,
+				       samples, &ns);
+	    summarize_frag(samples, ns, &stats->frag);
+	    printfrag(tracenum, samples, ns, &stats->frag);
+	    free(samples);
+	}
+	else
+	    stats->util = eval_mm_util(trace, tracenum, &stats->rss_util,
+				       NULL, NULL);
+	speed_params.trace = trace;
+	speed_params.touch = TOUCH_NONE;
+	if (!stream && trace->num_threads == 1)
+	    trace_pack(trace);
+	if (verbose > 1)
+	    printf("and performance.\n");
+	if (trace->num_threads > 1) {
+	    /* Replay the threads of a threaded trace concurrently */
+	    split_threads(trace, &speed_params);
+	    start_threads(&speed_params);
+	    stats->secs = time_trace(eval_mm_threads, &speed_params, stats);
+	    if (verbose) {
+		printf("Trace %d, by thread:\n", tracenum);
+		printf("%6s%8s%10s %6s\n", "thread", "ops", "secs", "Kops");
+		for (t = 0; t < trace->num_threads; t++) {
+		    ops = speed_params.threads[t].num_ops;
+		    printf("%6u%8u%10.6f %6.0f\n", t, ops,
+			   speed_params.threads[t].secs,
+			   (ops/1e3)/speed_params.threads[t].secs);
+		}
+		printf("%6s%8u%10.6f %6.0f\n", "all", trace->num_ops,
+		       stats->secs, (trace->num_ops/1e3)/stats->secs);
+	    }
+	    if (use_counters) {
+		stop_threads(&speed_params);
+		eval_mm_counters(eval_mm_threads_once, &speed_params,
+				 tracenum);
+		start_threads(&speed_params);
+	    }
+	    if (touch != TOUCH_NONE)
+		stats->touch_secs = time_touched(eval_mm_threads,
+						 &speed_params);
+	}
+	else {
+	    stats->secs = time_trace(eval_mm_speed, &speed_params, stats);
+	    if (use_counters)
+		eval_mm_counters(eval_mm_speed, &speed_params, tracenum);
+	    if (touch != TOUCH_NONE)
+		stats->touch_secs = time_touched(eval_mm_speed, &speed_params);
+	    if (calibrate)
+		stats->null_secs = time_trace(eval_null_speed, &speed_params,
+					      NULL);
+	}
+
+	/*
+	 * The throughput reference: libc malloc on the same trace, replayed
+	 * by the same threads as the mm package if the trace is threaded.
+	 * It is always timed on an in-memory copy, packed when possible,
+	 * so that the time that is cached does not depend on -S.
+	 */
+	if (libc_ref[tracenum].secs > 0 &&
+	    libc_ref[tracenum].ops == trace->num_ops)
+	    stats->libc_secs = libc_ref[tracenum].secs;
+	else {
+	    if (stream) {
+		speed_params.trace = read_trace(tracedir, tracefile);
+		trace_pack(speed_params.trace);
+	    }
+	    find_leftovers(speed_params.trace, &speed_params);
+	    stats->libc_secs = time_trace(trace->num_threads > 1 ?
+					  eval_libc_threads : eval_libc_speed,
+					  &speed_params, NULL);
+	    stats->libc_measured = 1;
+	    free(speed_params.leftover);
+	    if (stream)
+		free_trace(speed_params.trace);
+	}
+	if (trace->num_threads > 1) {
+	    stop_threads(&speed_params);
+	    for (t = 0; t < trace->num_threads; t++)
+		free(speed_params.threads[t].ops);
+	    free(speed_params.threads);
+	    free(speed_params.gen);
+	}
+	if (lat_every) {
+	    hist_t *hists = malloc(3 * sizeof(hist_t));
+
+	    if (hists == NULL)
+		unix_error("malloc failed in eval_trace");
+	    eval_mm_latency(trace, hists);
+	    for (t = ALLOC; t <= REALLOC; t++) {
+		double tpns = lat_ticks_per_ns();
+
+		stats->latency[t].count = hists[t].count;
+		stats->latency[t].p50 = hist_percentile(&hists[t], 50) / tpns;
+		stats->latency[t].p99 = hist_percentile(&hists[t], 99) / tpns;
+		stats->latency[t].p999 = hist_percentile(&hists[t], 99.9) / tpns;
+		stats->latency[t].max = hists[t].max / tpns;
+	    }
+	    printlatency(tracenum, stats->latency);
+	    free(hists);
+	}
+    }
+    free_trace(trace);
+}
+
+/*
+ * time_trace - Return the running time of the speed function f on a
+ *    trace, measured by fsecs_bench in benchmark mode and by fsecs
+ *    otherwise. The spread of the benchmark runs is kept in stats,
+ *    unless it is NULL.
+ */
+static double time_trace(fsecs_test_funct f, speed_t *params,
+			 stats_t *stats)
+{
+    fsecs_stats_t st;
+
+    if (bench)
+	return fsecs_bench(f, params, stats != NULL ? &stats->bench : &st);
+    return fsecs(f, params);
+}
+
+/*
+ * speed_stall - Return the time that the speed functions have waited
+ *    for the decoder of a streamed trace since the last call, which
+ *    fsecs leaves out of each run it times
+ */
+static double speed_stall(void *ptr)
+{
+    return trace_stall(((speed_t *)ptr)->trace);
+}
+
+/*
+ * time_touched - Return the running time of the speed function f on a
+ *    trace when the replay also touches the payloads (--touch), which
+ *    is the allocator's time plus the application's
+ */
+static double time_touched(fsecs_test_funct f, speed_t *params)
+{
+    double secs;
+
+    params->touch = touch;
+    secs = time_trace(f, params, NULL);
+    params->touch = TOUCH_NONE;
+    return secs;
+}
+
+/*
+ * eval_parallel - Evaluate the traces in up to jobs forked workers,
+ *    each with its own simulated heap and pinned to a CPU of its own,
+ *    so that no two traces are ever timed on the same core. Each worker
+ *    gets one trace number at a time over its command pipe, and sends
+ *    back a report_t for it over its result pipe.
+ */
+static void eval_parallel(char **tracefiles, int num_tracefiles, int jobs,
+			  int stream, stats_t *stats)
+{
+    cpu_set_t allowed, mask;
+    int cpus[CPU_SETSIZE];
+    int ncpus = 0;
+    int w, v, cpu, tracenum, next, done;
+    int cmd[2], res[2];
+    int *cmdfd, *resfd, *busy;
+    pid_t *pids;
+    struct pollfd *pfds;
+    report_t report;
+    shadow_t shadow;
+
+    /* There must be a CPU for every worker */
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+	unix_error("sched_getaffinity failed in eval_parallel");
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	if (CPU_ISSET(cpu, &allowed))
+	    cpus[ncpus++] = cpu;
+    if (jobs > ncpus)
+	jobs = ncpus;
+    if (jobs > num_tracefiles)
+	jobs = num_tracefiles;
+    if (verbose > 1)
+	printf("Evaluating traces in %d worker processes.\n", jobs);
+
+    cmdfd = malloc(jobs * sizeof(int));
+    resfd = malloc(jobs * sizeof(int));
+    busy = calloc(jobs, sizeof(int));
+    pids = malloc(jobs * sizeof(pid_t));
+    pfds = malloc(jobs * sizeof(struct pollfd));
+    if (!cmdfd || !resfd || !busy || !pids || !pfds)
+	unix_error("malloc failed in eval_parallel");
+
+    /* Don't let the workers inherit unwritten output */
+    fflush(stdout);
+
+    for (w = 0; w < jobs; w++) {
+	if (pipe(cmd) < 0 || pipe(res) < 0)
+	    unix_error("pipe failed in eval_parallel");
+	if ((pids[w] = fork()) < 0)
+	    unix_error("fork failed in eval_parallel");
+
+	if (pids[w] == 0) { /* worker */
+	    close(cmd[1]);
+	    close(res[0]);
+	    for (v = 0; v < w; v++) {
+		close(cmdfd[v]);
+		close(resfd[v]);
+	    }
+	    CPU_ZERO(&mask);
+	    CPU_SET(cpus[w], &mask);
+	    if (sched_setaffinity(0, sizeof(mask), &mask) < 0)
+		unix_error("sched_setaffinity failed in eval_parallel");
+
+	    init_heap();
+	    init_shadow(&shadow);
+	    while (readn(cmd[0], &tracenum, sizeof(int)) == sizeof(int)) {
+		report.tracenum = tracenum;
+		report.errors = errors;
+		memset(&report.stats, 0, sizeof(stats_t));
+		eval_trace(tracefiles[tracenum], tracenum, stream, &shadow,
+			   &report.stats);
+		report.errors = errors - report.errors;
+		fflush(stdout);
+		if (write(res[1], &report, sizeof(report)) != sizeof(report))
+		    unix_error("write failed in eval_parallel");
+	    }
+	    exit(0);
+	}
+
+	close(cmd[0]);
+	close(res[1]);
+	cmdfd[w] = cmd[1];
+	resfd[w] = res[0];
+    }
+
+    /* Hand out traces to workers as they become idle */
+    next = 0;
+    for (done = 0; done < num_tracefiles; ) {
+	for (w = 0; w < jobs; w++) {
+	    if (!busy[w] && next < num_tracefiles) {
+		if (write(cmdfd[w], &next, sizeof(int)) != sizeof(int))
+		    unix_error("write failed in eval_parallel");
+		busy[w] = 1;
+		next++;
+	    }
+	    pfds[w].fd = busy[w] ? resfd[w] : -1;
+	    pfds[w].events = POLLIN;
+	}
+	if (poll(pfds, jobs, -1) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    unix_error("poll failed in eval_parallel");
+	}
+
+	for (w = 0; w < jobs; w++) {
+	    if (!busy[w] || pfds[w].revents == 0)
+		continue;
+
+	    /* A worker that quits early has already said why */
+	    if (readn(resfd[w], &report, sizeof(report)) != sizeof(report)) {
+		for (v = 0; v < jobs; v++)
+		    kill(pids[v], SIGKILL);
+		exit(1);
+	    }
+	    stats[report.tracenum] = report.stats;
+	    errors += report.errors;
+	    busy[w] = 0;
+	    done++;
+	}
+    }
+
+    /* Closing the command pipes tells the workers to exit */
+    for (w = 0; w < jobs; w++) {
+	close(cmdfd[w]);
+	close(resfd[w]);
+	waitpid(pids[w], NULL, 0);
+    }
+    free(cmdfd);
+    free(resfd);
+    free(busy);
+    free(pids);
+    free(pfds);
+}
+
+/*************************************
+ * Some miscellaneous helper routines
+ ************************************/
+
+/*
+ * readn - read n bytes from fd, stopping early only at end of file
+ */
+static ssize_t readn(int fd, void *buf, size_t n)
+{
+    size_t left = n;
+    ssize_t nread;
+    char *p = buf;
+
+    while (left > 0) {
+	if ((nread = read(fd, p, left)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	if (nread == 0)
+	    break;
+	left -= nread;
+	p += nread;
+    }
+    return n - left;
+}
+
+
+/*
+ * touch_pages - write one byte in every page spanned by a payload, as an
+ *     application would, so that the pages show up in the resident set
+ */
+static void touch_pages(char *p, size_t size)
+{
+    size_t pagesize = mem_pagesize();
+    char *q;
+
+    for (q = p; q < p + size; q = (char *)(((uintptr_t)q | (pagesize - 1)) + 1))
+	*(volatile char *)q = 0;
+}
+
+/*
+ * init_heap - set up the simulated heap, and with -L fault it all in
+ *     and lock it in memory
+ */
+static void init_heap(void)
+{
+    mem_init();
+    if (lock_heap && mem_lock() < 0)
+	unix_error("Could not lock the heap in memory (is ulimit -l too low?)");
+}
+
+/*
+ * parse_cpus - parse a list of CPUs such as "2" or "0,4-7" into *set.
+ *     Returns 0 on success and -1 if the list is malformed.
+ */
+static int parse_cpus(char *s, cpu_set_t *set)
+{
+    long lo, hi, cpu;
+    char *end;
+
+    CPU_ZERO(set);
+    do {
+	lo = hi = strtol(s, &end, 10);
+	if (end == s)
+	    return -1;
+	if (*end == '-')
+	    hi = strtol(end + 1, &end, 10);
+	if (lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+	    return -1;
+	for (cpu = lo; cpu <= hi; cpu++)
+	    CPU_SET(cpu, set);
+	s = end + 1;
+    } while (*end == ',');
+    return *end == '\0' ? 0 : -1;
+}
+
+/*
+ * format_cpus - write the CPUs in *set to buf as a list of ranges,
+ *     like "0,4-7"
+ */
+static void format_cpus(cpu_set_t *set, char *buf, size_t size)
+{
+    int lo, hi;
+    size_t len = 0;
+
+    buf[0] = '\0';
+    for (lo = 0; lo < CPU_SETSIZE && len < size; lo = hi + 1) {
+	if (!CPU_ISSET(lo, set)) {
+	    hi = lo;
+	    continue;
+	}
+	for (hi = lo; hi + 1 < CPU_SETSIZE && CPU_ISSET(hi + 1, set); hi++)
+	    ;
+	len += snprintf(buf + len, size - len, len > 0 ? ",%d" : "%d", lo);
+	if (hi > lo && len < size)
+	    len += snprintf(buf + len, size - len, "-%d", hi);
+    }
+}
+
+/*
+ * read_first_line - read the first line of a file such as a sysfs
+ *     attribute into buf, without its newline. Returns 0 on success and
+ *     -1 if the file could not be read.
+ */
+static int read_first_line(char *path, char *buf, size_t size)
+{
+    FILE *f;
+
+    if ((f = fopen(path, "r")) == NULL)
+	return -1;
+    if (fgets(buf, size, f) == NULL) {
+	fclose(f);
+	return -1;
+    }
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+/*
+ * printresults - prints a performance summary for some malloc package
+ */
+static void printresults(int n, stats_t *stats) 
+{
+    int i;
+    double secs = 0;
+    double ops = 0;
+    double util = 0;
+    double rss_util = 0;
+    double libc_secs = 0;
+
+    /* Print the individual results for each trace */
+    /* All the space before the last number on each line is added by 
+     * Zheng Cai, for better formatting */
+    printf("%5s%7s %5s%5s%8s%10s %6s%7s%8s\n", 
+	   "trace", " valid", "util", "rss", "ops", "secs", "Kops",
+	   "libc", "speedup");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%10s%5.0f%%%4.0f%%%8.0f%10.6f %6.0f%7.0f%7.2fx\n", 
+		   i,
+		   "yes",
+		   stats[i].util*100.0,
+		   stats[i].rss_util*100.0,
+		   stats[i].ops,
+		   stats[i].secs,
+		   (stats[i].ops/1e3)/stats[i].secs,
+		   (stats[i].ops/1e3)/stats[i].libc_secs,
+		   stats[i].libc_secs/stats[i].secs);
+	    secs += stats[i].secs;
+	    libc_secs += stats[i].libc_secs;
+	    ops += stats[i].ops;
+	    util += stats[i].util;
+	    rss_util += stats[i].rss_util;
+	}
+	else {
+	    printf("%2d%10s%6s%5s%8s%10s %6s\n", 
+		   i,
+		   "no",
+		   "-",
+		   "-",
+		   "-",
+		   "-",
+		   "-");
+	}
+    }
+
+    /* Print the aggregate results for the set of traces */
+    if (errors == 0) {
+	printf("%12s%5.0f%%%4.0f%%%8.0f%10.6f %6.0f%7.0f%7.2fx\n", 
+	       "Total       ",
+	       (util/n)*100.0,
+	       (rss_util/n)*100.0,
+	       ops, 
+	       secs,
+	       (ops/1e3)/secs,
+	       (ops/1e3)/libc_secs,
+	       libc_secs/secs);
+    }
     else {
-	printf("%12s%6s%8s%10s %6s\n", 
+	printf("%12s%6s%5s%8s%10s %6s\n", 
 	       "Total       ",
 	       "-", 
 	       "-", 
 	       "-", 
+	       "-", 
 	       "-");
     }
 
 }
 
+/*
+ * printbench - prints the spread of the timed runs of each trace in
+ *     benchmark mode. A "*" marks a trace whose confidence interval
+ *     never reached its target.
+ */
+static void printbench(int n, stats_t *stats)
+{
+    fsecs_stats_t *b;
+    int i;
+
+    printf("Benchmark runs in usecs (mean +/- 95%% confidence interval):\n");
+    printf("%5s%6s%5s%11s%11s%11s%9s\n",
+	   "trace", "runs", "out", "mean", "median", "stddev", "ci");
+    for (i = 0; i < n; i++) {
+	b = &stats[i].bench;
+	if (!stats[i].valid || b->runs == 0) {
+	    printf("%2d%9s%5s%11s%11s%11s%9s\n",
+		   i, "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%9d%5d%11.2f%11.2f%11.2f%7.2f%%%s\n",
+	       i, b->runs, b->outliers, 1e6 * b->mean, 1e6 * b->median,
+	       1e6 * b->stddev, 100 * b->ci / b->mean,
+	       b->converged ? "" : "*");
+    }
+}
+
+/*
+ * printtouch - prints the time of each trace with and without touching
+ *     the payloads (--touch)
+ */
+static void printtouch(int n, stats_t *stats)
+{
+    stats_t *st;
+    int i;
+
+    printf("Allocator and application time in usecs, touching %s:\n",
+	   touch == TOUCH_LINE ? "the first line of each payload"
+	   : "whole payloads");
+    printf("%5s%11s%11s%9s%9s%8s\n",
+	   "trace", "alloc", "+touch", "Kops", "Kops+t", "extra");
+    for (i = 0; i < n; i++) {
+	st = &stats[i];
+	if (!st->valid) {
+	    printf("%2d%14s%11s%9s%9s%8s\n", i, "-", "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%14.2f%11.2f%9.0f%9.0f%7.1f%%\n", i,
+	       1e6 * st->secs, 1e6 * st->touch_secs,
+	       st->ops / 1e3 / st->secs, st->ops / 1e3 / st->touch_secs,
+	       100 * (st->touch_secs - st->secs) / st->secs);
+    }
+}
+
+/*
+ * printnull - prints how much of each trace's time the driver itself
+ *     took (-n), and the throughput of the mm package without it
+ */
+static void printnull(int n, stats_t *stats)
+{
+    stats_t *st;
+    double secs = 0, null_secs = 0, ops = 0;
+    int i;
+
+    printf("Driver overhead in usecs, replaying against a null allocator:\n");
+    printf("%5s%11s%11s%8s%9s%9s\n",
+	   "trace", "usecs", "driver", "share", "Kops", "net Kops");
+    for (i = 0; i < n; i++) {
+	st = &stats[i];
+	if (!st->valid || st->null_secs == 0) { /* threaded traces too */
+	    printf("%2d%14s%11s%8s%9s%9s\n", i, "-", "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%14.2f%11.2f%7.1f%%%9.0f%9.0f\n", i,
+	       1e6 * st->secs, 1e6 * st->null_secs,
+	       100 * st->null_secs / st->secs, st->ops / 1e3 / st->secs,
+	       st->null_secs < st->secs ?
+	       st->ops / 1e3 / (st->secs - st->null_secs) : INFINITY);
+	secs += st->secs;
+	null_secs += st->null_secs;
+	ops += st->ops;
+    }
+    if (secs > 0)
+	printf("%5s%11.2f%11.2f%7.1f%%%9.0f%9.0f\n", "Total",
+	       1e6 * secs, 1e6 * null_secs, 100 * null_secs / secs,
+	       ops / 1e3 / secs, null_secs < secs ?
+	       ops / 1e3 / (secs - null_secs) : INFINITY);
+}
+
+/*
+ * printlatency - prints the latency percentiles of one trace's requests
+ */
+static void printlatency(int tracenum, latency_t *latency)
+{
+    static char *names[] = {"malloc", "free", "realloc"};
+    latency_t *l;
+    int t;
+
+    printf("Trace %d latency in ns, timing 1 in %u requests "
+	   "(less %.0f ns timer overhead):\n",
+	   tracenum, lat_every, lat_overhead() / lat_ticks_per_ns());
+    printf("%7s%9s%9s%9s%9s%9s\n",
+	   "request", "count", "p50", "p99", "p99.9", "max");
+    for (t = ALLOC; t <= REALLOC; t++) {
+	l = &latency[t];
+	if (l->count > 0)
+	    printf("%7s%9lu%9.0f%9.0f%9.0f%9.0f\n", names[t], l->count,
+		   l->p50, l->p99, l->p999, l->max);
+    }
+}
+
+/*
+ * sample_heap - record the layout of the heap after op requests, while
+ *     payload bytes are live
+ */
+static void sample_heap(heapsample_t *sample, unsigned op, size_t payload)
+{
+    memset(sample, 0, sizeof(heapsample_t));
+    sample->op = op;
+    sample->heap = mem_heapsize();
+    sample->payload = payload;
+    mm_heapwalk(visit_block, sample);
+}
+
+/*
+ * visit_block - add one block of the heap to the heapsample_t at arg
+ */
+static void visit_block(void *bp, size_t size, int allocated, void *arg)
+{
+    heapsample_t *sample = arg;
+    int c;
+    size_t limit;
+
+    (void)bp;
+    if (allocated) {
+	sample->allocated += size;
+	return;
+    }
+    sample->free += size;
+    if (size > sample->largest)
+	sample->largest = size;
+    for (c = 0, limit = 64; c < FRAG_CLASSES - 1 && size >= limit; c++)
+	limit *= 4;
+    sample->free_class[c] += size;
+}
+
+/*
+ * summarize_frag - average the fragmentation of a trace's heap samples,
+ *     and find where the heap grew the most
+ */
+static void summarize_frag(heapsample_t *samples, unsigned n, frag_t *frag)
+{
+    heapsample_t *s;
+    size_t prev = 0;
+    unsigned i;
+
+    memset(frag, 0, sizeof(frag_t));
+    for (i = 0; i < n; i++) {
+	s = &samples[i];
+	if (s->heap > 0) {
+	    frag->internal += (double)(s->allocated - s->payload) / s->heap;
+	    frag->external += (double)s->free / s->heap;
+	}
+	if (s->free > 0)
+	    frag->scattered += 1 - (double)s->largest / s->free;
+	if (s->heap - prev > frag->grew_by) {
+	    frag->grew_by = s->heap - prev;
+	    frag->grew_at = i;
+	}
+	prev = s->heap;
+    }
+    if ((frag->samples = n) > 0) {
+	frag->internal /= n;
+	frag->external /= n;
+	frag->scattered /= n;
+    }
+}
+
+/*
+ * printfrag - prints the heap samples of one trace, in KB, and a summary
+ *     of its fragmentation
+ */
+static void printfrag(int tracenum, heapsample_t *samples, unsigned n,
+		      frag_t *frag)
+{
+    static char *classes[FRAG_CLASSES] =
+	{"<64", "<256", "<1K", "<4K", "<16K", "<64K", ">=64K"};
+    heapsample_t *s;
+    unsigned i;
+    int c;
+
+    printf("Trace %d heap layout every %u requests, in KB:\n",
+	   tracenum, frag_every);
+    printf("%9s%9s%9s%9s%9s%9s  free by block size:\n",
+	   "op", "heap", "payload", "alloc", "free", "largest");
+    printf("%54s", "");
+    for (c = 0; c < FRAG_CLASSES; c++)
+	printf("%8s", classes[c]);
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	s = &samples[i];
+	printf("%9u%9.1f%9.1f%9.1f%9.1f%9.1f", s->op, s->heap / 1024.0,
+	       s->payload / 1024.0, s->allocated / 1024.0,
+	       s->free / 1024.0, s->largest / 1024.0);
+	for (c = 0; c < FRAG_CLASSES; c++)
+	    printf("%8.1f", s->free_class[c] / 1024.0);
+	printf("\n");
+    }
+    if (n == 0)
+	return;
+    printf("Trace %d fragmentation, as a mean share of the heap: "
+	   "internal %.1f%%, external %.1f%%\n", tracenum,
+	   100 * frag->internal, 100 * frag->external);
+    printf("  %.1f%% of free bytes were outside the largest free block; "
+	   "the heap grew most\n  (%.1f KB) between requests %u and %u\n",
+	   100 * frag->scattered, frag->grew_by / 1024.0,
+	   frag->grew_at > 0 ? samples[frag->grew_at - 1].op : 0,
+	   samples[frag->grew_at].op);
+}
+
+/*
+ * get_host - describe the host that mdriver runs on
+ */
+static void get_host(host_t *host)
+{
+    struct utsname uts;
+    cpu_set_t allowed;
+    FILE *f;
+    char line[MAXLINE], path[MAXLINE], *p;
+    int cpu;
+
+    strcpy(host->hostname, "unknown");
+    strcpy(host->kernel, "unknown");
+    strcpy(host->cpu, "unknown");
+    if (uname(&uts) == 0) {
+	snprintf(host->hostname, MAXLINE, "%s", uts.nodename);
+	snprintf(host->kernel, MAXLINE, "%s %s %s",
+		 uts.sysname, uts.release, uts.machine);
+    }
+    if ((f = fopen("/proc/cpuinfo", "r")) != NULL) {
+	while (fgets(line, MAXLINE, f) != NULL)
+	    if (!strncmp(line, "model name", 10) &&
+		(p = strchr(line, ':')) != NULL) {
+		p += strspn(p, ": \t");
+		p[strcspn(p, "\n")] = '\0';
+		snprintf(host->cpu, MAXLINE, "%s", p);
+		break;
+	    }
+	fclose(f);
+    }
+    host->cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    /* Where we run, and how fast the first of those CPUs is clocked */
+    strcpy(host->affinity, "unknown");
+    strcpy(host->governor, "unknown");
+    host->mhz = 0;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+	format_cpus(&allowed, host->affinity, MAXLINE);
+	for (cpu = 0; cpu < CPU_SETSIZE && !CPU_ISSET(cpu, &allowed); cpu++)
+	    ;
+	sprintf(path, "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor",
+		cpu);
+	read_first_line(path, host->governor, MAXLINE);
+	sprintf(path, "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq",
+		cpu);
+	if (read_first_line(path, line, MAXLINE) == 0)
+	    host->mhz = strtod(line, NULL) / 1e3;
+    }
+    if (host->mhz == 0 && (f = fopen("/proc/cpuinfo", "r")) != NULL) {
+	/* No cpufreq, as in most VMs, but the kernel may still know */
+	while (fgets(line, MAXLINE, f) != NULL)
+	    if (!strncmp(line, "cpu MHz", 7) &&
+		(p = strchr(line, ':')) != NULL) {
+		host->mhz = strtod(p + 1, NULL);
+		break;
+	    }
+	fclose(f);
+    }
+
+    errno = 0;
+    host->nice = getpriority(PRIO_PROCESS, 0);
+    host->locked = lock_heap;
+}
+
+/*
+ * libc_cache_path - the path of the libc time cache in the home
+ *     directory. Returns -1 if there is no home directory.
+ */
+static int libc_cache_path(char *path)
+{
+    char *home = getenv("HOME");
+
+    if (home == NULL || *home == '\0')
+	return -1;
+    snprintf(path, MAXLINE, "%s/%s", home, LIBC_CACHE);
+    return 0;
+}
+
+/*
+ * trace_key - the name a trace is cached under: the size and the
+ *     modification time of its file, so that a rewritten trace is timed
+ *     again, and the absolute path of the file if it can be found, else
+ *     its path as given
+ */
+static void trace_key(char *tracefile, char *key)
+{
+    char path[MAXLINE], real[PATH_MAX];
+    struct stat st;
+    int len;
+
+    snprintf(path, MAXLINE, "%s%s", tracedir, tracefile);
+    if (stat(path, &st) < 0)
+	memset(&st, 0, sizeof(st));
+    len = snprintf(key, MAXLINE, "%lld\t%lld.%09ld\t",
+		   (long long)st.st_size, (long long)st.st_mtim.tv_sec,
+		   st.st_mtim.tv_nsec);
+    if (realpath(path, real) == NULL || len + strlen(real) >= MAXLINE)
+	strcpy(real, path);
+    if (len + strlen(real) < MAXLINE)
+	strcpy(key + len, real);
+}
+
+/*
+ * load_libc_cache - fill libc_ref with the libc times that the cache
+ *     holds for these traces on this CPU, timed by method (the timer,
+ *     and ",bench" in benchmark mode). Each line of the cache is
+ *
+ *         <secs> TAB <ops> TAB <cpu model> TAB <method> TAB <trace key>
+ *
+ *     where the trace key is made by trace_key, and a later line for
+ *     the same CPU, method and trace replaces an earlier one.
+ */
+static void load_libc_cache(char *cpu, char *method, char **tracefiles,
+			    int n)
+{
+    char path[MAXLINE], line[4 * MAXLINE], key[MAXLINE];
+    char *model, *how, *trace, *end;
+    libc_ref_t ref;
+    FILE *f;
+    int i;
+
+    if (libc_cache_path(path) < 0 || (f = fopen(path, "r")) == NULL)
+	return;
+    while (fgets(line, sizeof(line), f) != NULL) {
+	line[strcspn(line, "\n")] = '\0';
+	ref.secs = strtod(line, &end);
+	if (*end != '\t')
+	    continue;
+	ref.ops = strtoul(end + 1, &end, 10);
+	if (*end != '\t')
+	    continue;
+	model = end + 1;
+	if ((how = strchr(model, '\t')) == NULL)
+	    continue;
+	*how++ = '\0';
+	if ((trace = strchr(how, '\t')) == NULL)
+	    continue;
+	*trace++ = '\0';
+	if (strcmp(model, cpu) != 0 || strcmp(how, method) != 0 ||
+	    ref.secs <= 0)
+	    continue;
+	for (i = 0; i < n; i++) {
+	    trace_key(tracefiles[i], key);
+	    if (!strcmp(trace, key))
+		libc_ref[i] = ref;
+	}
+    }
+    fclose(f);
+}
+
+/*
+ * save_libc_cache - add the libc times that were measured in this run
+ *     by method to the cache
+ */
+static void save_libc_cache(char *cpu, char *method, char **tracefiles,
+			    int n, stats_t *stats)
+{
+    char path[MAXLINE], key[MAXLINE];
+    FILE *f = NULL;
+    int i;
+
+    if (libc_cache_path(path) < 0)
+	return;
+    for (i = 0; i < n; i++) {
+	if (!stats[i].libc_measured)
+	    continue;
+	if (f == NULL && (f = fopen(path, "a")) == NULL) {
+	    printf("Warning: could not write %s: %s\n", path,
+		   strerror(errno));
+	    return;
+	}
+	trace_key(tracefiles[i], key);
+	fprintf(f, "%.9f\t%.0f\t%s\t%s\t%s\n", stats[i].libc_secs,
+		stats[i].ops, cpu, method, key);
+    }
+    if (f != NULL)
+	fclose(f);
+}
+
+/*
+ * printhost - prints how the machine was set up for timing
+ */
+static void printhost(host_t *host)
+{
+    printf("Timing on CPUs %s (%s governor", host->affinity, host->governor);
+    if (host->mhz > 0)
+	printf(", %.0f MHz", host->mhz);
+    printf("), nice %d, heap %s\n", host->nice,
+	   host->locked ? "locked in memory" : "paged on demand");
+}
+
+/*
+ * write_results - write the results of all the traces to out as JSON
+ *     or CSV, along with the host that measured them. Each trace's JSON
+ *     object is on a line of its own, which compare_results relies on,
+ *     and its measurements are written at full precision, so that a
+ *     run compared with its own results shows no change.
+ */
+static void write_results(FILE *out, int format, char **tracefiles, int n,
+			  stats_t *stats, double perfindex, char *timer)
+{
+    static char *names[] = {"malloc", "free", "realloc"};
+    host_t host;
+    stats_t *st;
+    latency_t *l;
+    int i, t;
+
+    get_host(&host);
+
+    if (format == FORMAT_CSV) {
+	fprintf(out, "trace,file,valid,ops,secs,kops,util,rss_util,"
+		"libc_secs,speedup,runs,ci_pct");
+	for (t = ALLOC; t <= REALLOC; t++)
+	    fprintf(out, ",%s_p50_ns,%s_p99_ns,%s_p999_ns,%s_max_ns",
+		    names[t], names[t], names[t], names[t]);
+	fprintf(out, ",host,cpu,cpus,kernel,timer,affinity,governor,mhz,"
+		"nice,locked\n");
+	for (i = 0; i < n; i++) {
+	    st = &stats[i];
+	    fprintf(out, "%d,", i);
+	    write_csv_string(out, tracefiles[i]);
+	    fprintf(out, ",%d,%.0f", st->valid, st->ops);
+	    if (st->valid)
+		fprintf(out, ",%.9f,%.1f,%.4f,%.4f,%.9f,%.3f", st->secs,
+			st->ops / 1e3 / st->secs, st->util, st->rss_util,
+			st->libc_secs, st->libc_secs / st->secs);
+	    else
+		fprintf(out, ",,,,,,");
+	    if (st->bench.runs > 0)
+		fprintf(out, ",%d,%.3f", st->bench.runs,
+			100 * st->bench.ci / st->bench.mean);
+	    else
+		fprintf(out, ",,");
+	    for (t = ALLOC; t <= REALLOC; t++) {
+		l = &st->latency[t];
+		if (l->count > 0)
+		    fprintf(out, ",%.0f,%.0f,%.0f,%.0f",
+			    l->p50, l->p99, l->p999, l->max);
+		else
+		    fprintf(out, ",,,,");
+	    }
+	    fputc(',', out);
+	    write_csv_string(out, host.hostname);
+	    fputc(',', out);
+	    write_csv_string(out, host.cpu);
+	    fprintf(out, ",%ld,", host.cpus);
+	    write_csv_string(out, host.kernel);
+	    fputc(',', out);
+	    write_csv_string(out, timer);
+	    fputc(',', out);
+	    write_csv_string(out, host.affinity);
+	    fputc(',', out);
+	    write_csv_string(out, host.governor);
+	    fprintf(out, ",%.0f,%d,%d\n", host.mhz, host.nice, host.locked);
+	}
+	return;
+    }
+
+    fprintf(out, "{\n  \"host\": {\"hostname\": ");
+    write_json_string(out, host.hostname);
+    fprintf(out, ", \"cpu\": ");
+    write_json_string(out, host.cpu);
+    fprintf(out, ", \"cpus\": %ld, \"kernel\": ", host.cpus);
+    write_json_string(out, host.kernel);
+    fprintf(out, ", \"timer\": ");
+    write_json_string(out, timer);
+    fprintf(out, ", \"affinity\": ");
+    write_json_string(out, host.affinity);
+    fprintf(out, ", \"governor\": ");
+    write_json_string(out, host.governor);
+    fprintf(out, ", \"mhz\": %.0f, \"nice\": %d, \"locked\": %s",
+	    host.mhz, host.nice, host.locked ? "true" : "false");
+    fprintf(out, "},\n  \"errors\": %d,\n  \"perfidx\": %.1f,\n",
+	    errors, perfindex);
+    fprintf(out, "  \"traces\": [\n");
+    for (i = 0; i < n; i++) {
+	st = &stats[i];
+	fprintf(out, "    {\"trace\": %d, \"file\": ", i);
+	write_json_string(out, tracefiles[i]);
+	fprintf(out, ", \"valid\": %s, \"ops\": %.0f",
+		st->valid ? "true" : "false", st->ops);
+	if (st->valid)
+	    fprintf(out, ", \"secs\": %.17g, \"kops\": %.17g, "
+		    "\"util\": %.17g, \"rss_util\": %.17g, "
+		    "\"libc_secs\": %.17g, \"speedup\": %.17g", st->secs,
+		    st->ops / 1e3 / st->secs, st->util, st->rss_util,
+		    st->libc_secs, st->libc_secs / st->secs);
+	if (st->bench.runs > 0)
+	    fprintf(out, ", \"runs\": %d, \"outliers\": %d, "
+		    "\"median\": %.17g, \"stddev\": %.17g, \"ci\": %.17g",
+		    st->bench.runs, st->bench.outliers, st->bench.median,
+		    st->bench.stddev, st->bench.ci);
+	if (lat_every) {
+	    fprintf(out, ", \"latency_ns\": {");
+	    for (t = ALLOC; t <= REALLOC; t++) {
+		l = &st->latency[t];
+		fprintf(out, "%s\"%s\": {\"count\": %lu, \"p50\": %.0f, "
+			"\"p99\": %.0f, \"p999\": %.0f, \"max\": %.0f}",
+			t == ALLOC ? "" : ", ", names[t], l->count,
+			l->p50, l->p99, l->p999, l->max);
+	    }
+	    fprintf(out, "}");
+	}
+	if (touch != TOUCH_NONE && st->valid)
+	    fprintf(out, ", \"touch_secs\": %.17g", st->touch_secs);
+	if (st->null_secs > 0)
+	    fprintf(out, ", \"driver_secs\": %.17g", st->null_secs);
+	if (st->frag.samples > 0)
+	    fprintf(out, ", \"frag\": {\"samples\": %u, \"internal\": %.4f, "
+		    "\"external\": %.4f, \"scattered\": %.4f}",
+		    st->frag.samples, st->frag.internal, st->frag.external,
+		    st->frag.scattered);
+	fprintf(out, "}%s\n", i < n - 1 ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+/*
+ * write_json_string - write s to out as a JSON string
+ */
+static void write_json_string(FILE *out, char *s)
+{
+    fputc('"', out);
+    for (; *s != '\0'; s++) {
+	if (*s == '"' || *s == '\\')
+	    fprintf(out, "\\%c", *s);
+	else if ((unsigned char)*s < 0x20)
+	    fprintf(out, "\\u%04x", *s);
+	else
+	    fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+/*
+ * write_csv_string - write s to out as a quoted CSV field, doubling
+ *     any quotes in it (RFC 4180)
+ */
+static void write_csv_string(FILE *out, char *s)
+{
+    fputc('"', out);
+    for (; *s != '\0'; s++) {
+	if (*s == '"')
+	    fputc('"', out);
+	fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+/*
+ * json_number - the number after "key": in line, or -1 if the key
+ *     isn't there
+ */
+static double json_number(char *line, char *key)
+{
+    char pat[MAXLINE], *p;
+
+    snprintf(pat, MAXLINE, "\"%s\": ", key);
+    if ((p = strstr(line, pat)) == NULL)
+	return -1;
+    return strtod(p + strlen(pat), NULL);
+}
+
+/*
+ * compare_results - Compare the results of each trace with those of the
+ *     trace with the same file name in the baseline at path, which
+ *     must have been written by --format=json. A change in throughput
+ *     is significant if it is larger than the 95% confidence intervals
+ *     of both runs combined (when both runs were made with -b); a
+ *     significant drop of more than threshold percent, or a drop in
+ *     utilization of more than threshold percent, is a regression.
+ *     Returns the number of regressions.
+ */
+static int compare_results(char *path, char **tracefiles, int n,
+			   stats_t *stats, double threshold)
+{
+    FILE *f;
+    char line[4 * MAXLINE], file[MAXLINE], *p, *q;
+    double kops, util, ci, base_kops, base_util, base_ci, noise, dk, du;
+    int i, found, significant, regressed, regressions = 0;
+
+    if ((f = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open baseline %s", path);
+	unix_error(msg);
+    }
+
+    printf("Comparison with %s (regression threshold %.1f%%):\n",
+	   path, threshold);
+    printf("%5s%10s%10s%9s%7s%7s%9s\n",
+	   "trace", "Kops", "base", "delta", "util", "base", "delta");
+    for (i = 0; i < n; i++) {
+	/* Find the trace's line in the baseline */
+	rewind(f);
+	found = 0;
+	while (!found && fgets(line, sizeof(line), f) != NULL) {
+	    if ((p = strstr(line, "\"file\": \"")) == NULL)
+		continue;
+	    for (p += 9, q = file; *p != '"' && *p != '\0' &&
+		     q < file + MAXLINE - 1; p++)
+		*q++ = (*p == '\\' && p[1] != '\0') ? *++p : *p;
+	    *q = '\0';
+	    found = !strcmp(file, tracefiles[i]);
+	}
+	base_kops = found ? json_number(line, "kops") : -1;
+	if (!stats[i].valid || base_kops <= 0) {
+	    printf("%2d%35s\n", i, found ? "(not valid)" : "(not in baseline)");
+	    continue;
+	}
+	base_util = json_number(line, "util");
+	base_ci = json_number(line, "ci");
+	if (base_ci >= 0)
+	    base_ci /= json_number(line, "secs");
+
+	kops = stats[i].ops / 1e3 / stats[i].secs;
+	util = stats[i].util;
+	ci = stats[i].bench.runs > 0 ? stats[i].bench.ci / stats[i].bench.mean
+	    : -1;
+	dk = 100 * (kops - base_kops) / base_kops;
+	du = 100 * (util - base_util) / base_util;
+
+	/* Without intervals on both sides, any change may be noise */
+	noise = (ci >= 0 && base_ci >= 0) ? 100 * sqrt(ci*ci + base_ci*base_ci)
+	    : 0;
+	significant = (ci >= 0 && base_ci >= 0) ? fabs(dk) > noise : -1;
+	regressed = (dk < -threshold && significant != 0) || du < -threshold;
+	regressions += regressed;
+
+	printf("%2d%13.0f%10.0f%+8.1f%%%6.0f%%%6.0f%%%+8.1f%%  %s\n",
+	       i, kops, base_kops, dk, 100 * util, 100 * base_util, du,
+	       regressed ? "REGRESSION" :
+	       significant == 1 ? (dk > 0 ? "faster" : "slower") :
+	       significant == 0 ? "noise" : "");
+    }
+    fclose(f);
+    if (regressions > 0)
+	printf("%d trace%s regressed by more than %.1f%%\n",
+	       regressions, regressions > 1 ? "s" : "", threshold);
+    return regressions;
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -873,10 +2924,10 @@ void unix_error(char *msg)
 /*
  * malloc_error - Report an error returned by the mm_malloc package
  */
-void malloc_error(int tracenum, int opnum, char *msg)
+void malloc_error(int tracenum, int linenum, char *msg)
 {
     errors++;
-    printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
+    printf("ERROR [trace %d, line %d]: %s\n", tracenum, linenum, msg);
 }
 
 /* 
@@ -884,13 +2935,50 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-aghvV] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-aCcFghLnpRSvV] [-b <w>[,<ci>[,<max>]]] [-f <file>]\n"
+	    "               [-j <n>] [-l <n>] [-m <MB>] [-P <cpus>] [-s <ns>[,<ns>]]\n"
+	    "               [-T <timer>] [-t <dir>] [-u <n>] [--format=json|csv]\n"
+	    "               [--output=<file>] [--compare=<baseline.json>]\n"
+	    "               [--threshold=<pct>] [--touch=line|full]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-b <w>,<ci>,<max>\n"
+	    "\t           Benchmark: after <w> warmup runs, time each trace until the\n"
+	    "\t           95%% confidence interval is within <ci>%% (default 1) of the\n"
+	    "\t           mean, or for at most <max> runs (default %d).\n",
+	    BENCH_MAX_RUNS);
+    fprintf(stderr, "\t-C         Time libc malloc again, instead of using the times\n"
+	    "\t           cached in ~/%s for this CPU and timer.\n", LIBC_CACHE);
+    fprintf(stderr, "\t-c         Count hardware events (cycles, cache misses...) per trace.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F         Regrow the heap from fresh pages on every run.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate up to <n> traces at once, each on its own CPU.\n");
+    fprintf(stderr, "\t-l <n>     Time 1 in <n> requests and print latency percentiles.\n");
+    fprintf(stderr, "\t-L         Fault in the whole heap and lock it in memory (resident\n"
+	    "\t           heap sizes are then not meaningful).\n");
+    fprintf(stderr, "\t-m <MB>    Limit the simulated heap to <MB> megabytes.\n");
+    fprintf(stderr, "\t-n         Measure the driver's own time by replaying each trace\n"
+	    "\t           against a null allocator, and print net throughput.\n");
+    fprintf(stderr, "\t-P <cpus>  Run on these CPUs only, e.g. 2 or 0,4-7.\n");
+    fprintf(stderr, "\t-p         Fill payloads with position-dependent patterns.\n");
+    fprintf(stderr, "\t-R         Run at the highest scheduling priority.\n");
+    fprintf(stderr, "\t-S         Stream traces instead of loading them. Time spent waiting\n"
+	    "\t           for the decoder is left out of the speed measurement.\n");
+    fprintf(stderr, "\t-s <c>,<p> Charge <c> ns per mem_sbrk call and <p> ns per new page.\n");
+    fprintf(stderr, "\t-T <timer> Time with fcyc, itimer, gettod or mono (default %s).\n",
+	    DEFAULT_TIMER);
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-u <n>     Sample the heap layout every <n> requests and print\n"
+	    "\t           internal and external fragmentation.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t--format=json|csv  Write the results of every trace, and the host.\n");
+    fprintf(stderr, "\t--output=<file>    ... to <file> instead of stdout. Without it, all\n"
+	    "\t                   other output goes to stderr.\n");
+    fprintf(stderr, "\t--compare=<file>   Compare with results written by --format=json.\n");
+    fprintf(stderr, "\t--threshold=<pct>  Exit with status 2 if a trace is <pct>%% worse (default 5).\n");
+    fprintf(stderr, "\t--touch=line|full  Also time traces writing the first line or all of each\n"
+	    "\t                   payload after malloc, and reading it before free.\n");
 }
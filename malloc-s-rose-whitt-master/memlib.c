@@ -2,6 +2,29 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            The simulated heap is a single virtual address range that is
+ *            reserved with no access rights by mem_init.  Pages are
+ *            committed (made readable and writable) on demand as mem_sbrk
+ *            moves the break past them, so an idle or small heap costs
+ *            only address space, not memory.
+ *
+ *            All of the state of a heap lives in a mem_ctx_t, so several
+ *            heaps can coexist in one process.  The mem_ctx_xxx functions
+ *            operate on an explicit context; the classic mem_xxx functions
+ *            operate on a default context that mem_init sets up.
+ *
+ *            Because mem_sbrk is only a pointer bump, growing the heap is
+ *            far cheaper than with a real sbrk.  Optionally, memlib can
+ *            charge a simulated cost for every mem_sbrk call and for every
+ *            page the heap grows into (mem_set_sbrk_cost), and it can hand
+ *            out fresh pages after every mem_reset_brk so that the first
+ *            touch of each page takes a real page fault
+ *            (mem_set_fresh_pages).
+ *
+ *            For steadier timings, mem_lock commits the whole heap up
+ *            front and locks it in memory, so that no page fault is ever
+ *            taken while the allocator runs.
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,28 +33,376 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/* Pages are committed in units of this many bytes to limit mprotect calls */
+#define COMMIT_CHUNK (1<<16)  /* 64 KB */
+
+/* The state of one simulated heap */
+struct mem_ctx {
+    char *start_brk;         /* points to first byte of heap */
+    char *brk;               /* points to last byte of heap */
+    char *commit_brk;        /* points past last committed heap byte */
+    char *max_addr;          /* largest legal heap address */ 
+    size_t max_heap;         /* size of the heap reservation */
+    unsigned char *pagevec;  /* mincore residency vector */
+    size_t peak_resident;    /* resident high water mark in bytes */
+    int track_resident;      /* sample the peak before releasing pages? */
+    int locked;              /* is the whole heap locked in memory? */
+};
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_ctx_t mem_default = { .max_heap = MAX_HEAP }; /* default heap */
+static double sbrk_call_ns;  /* simulated cost of each mem_sbrk call */
+static double sbrk_page_ns;  /* simulated cost of each new heap page */
+static int fresh_pages;      /* if set, mem_reset_brk discards all pages */
+
+/* 
+ * mem_set_sbrk_cost - charge ns_per_call nanoseconds for every mem_sbrk
+ *    call and ns_per_page nanoseconds for every page it adds to the heap.
+ *    The cost is paid by spinning, so it shows up in measured run times.
+ *    Applies to all heaps.  Both costs are 0 by default.
+ */
+void mem_set_sbrk_cost(double ns_per_call, double ns_per_page)
+{
+    sbrk_call_ns = ns_per_call;
+    sbrk_page_ns = ns_per_page;
+}
+
+/* 
+ * mem_set_fresh_pages - when set, mem_reset_brk replaces the heap with
+ *    fresh, uncommitted pages, so that a regrown heap pays for mprotect
+ *    calls and first-touch page faults just like a new process would.
+ *    Applies to all heaps.  Off by default.
+ */
+void mem_set_fresh_pages(int fresh)
+{
+    fresh_pages = fresh;
+}
+
+/* 
+ * mem_spin - busy-wait for ns nanoseconds
+ */
+static void mem_spin(double ns)
+{
+    struct timespec start, now;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+	clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ((now.tv_sec - start.tv_sec) * 1e9 +
+	     (now.tv_nsec - start.tv_nsec) < ns);
+}
+
+/* 
+ * mem_ctx_setup - reserve the address range for a heap of at most
+ *    max_heap bytes and make the heap empty.  Returns 0 on success and
+ *    -1 on error.
+ */
+static int mem_ctx_setup(mem_ctx_t *ctx, size_t max_heap)
+{
+    size_t pagesize = mem_pagesize();
+
+    ctx->max_heap = (max_heap + pagesize - 1) / pagesize * pagesize;
+
+    /* reserve, but do not commit, the address range that models the VM */
+    ctx->start_brk = mmap(NULL, ctx->max_heap, PROT_NONE,
+			  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ctx->start_brk == MAP_FAILED) {
+	ctx->start_brk = NULL;
+	return -1;
+    }
+
+    /* one residency byte per page of the reservation, for mincore */
+    if ((ctx->pagevec = malloc(ctx->max_heap / pagesize)) == NULL) {
+	munmap(ctx->start_brk, ctx->max_heap);
+	ctx->start_brk = NULL;
+	return -1;
+    }
+
+    ctx->max_addr = ctx->start_brk + ctx->max_heap; /* max legal heap address */
+    ctx->brk = ctx->start_brk;                  /* heap is empty initially */
+    ctx->commit_brk = ctx->start_brk;           /* nothing is committed yet */
+    ctx->peak_resident = 0;
+    ctx->track_resident = 0;
+    ctx->locked = 0;
+    return 0;
+}
+
+/* 
+ * mem_ctx_teardown - release everything that mem_ctx_setup acquired
+ */
+static void mem_ctx_teardown(mem_ctx_t *ctx)
+{
+    munmap(ctx->start_brk, ctx->max_heap);
+    ctx->start_brk = NULL;
+    free(ctx->pagevec);
+    ctx->pagevec = NULL;
+}
+
+/* 
+ * mem_ctx_create - create a new, empty heap of at most max_heap bytes.
+ *    Returns NULL on error.
+ */
+mem_ctx_t *mem_ctx_create(size_t max_heap)
+{
+    mem_ctx_t *ctx;
+
+    if ((ctx = malloc(sizeof(mem_ctx_t))) == NULL)
+	return NULL;
+    if (mem_ctx_setup(ctx, max_heap) < 0) {
+	free(ctx);
+	return NULL;
+    }
+    return ctx;
+}
+
+/* 
+ * mem_ctx_destroy - free a heap created by mem_ctx_create
+ */
+void mem_ctx_destroy(mem_ctx_t *ctx)
+{
+    mem_ctx_teardown(ctx);
+    free(ctx);
+}
+
+/*
+ * mem_ctx_reset_brk - reset the simulated brk pointer to make an empty
+ *    heap.  Committed pages stay committed so that the heap can be
+ *    regrown without further system calls, unless fresh pages were
+ *    requested.
+ */
+void mem_ctx_reset_brk(mem_ctx_t *ctx)
+{
+    if (fresh_pages && !ctx->locked && ctx->commit_brk > ctx->start_brk) {
+	if (mmap(ctx->start_brk, ctx->commit_brk - ctx->start_brk, PROT_NONE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+		 -1, 0) == MAP_FAILED) {
+	    fprintf(stderr, "mem_reset_brk: mmap error: %s\n",
+		    strerror(errno));
+	    exit(1);
+	}
+	ctx->commit_brk = ctx->start_brk;
+    }
+    ctx->brk = ctx->start_brk;
+    ctx->track_resident = 0;
+}
+
+/*
+ * mem_ctx_reset_resident - discard the contents of every committed heap
+ *    page, so that none of them is resident until it is touched again,
+ *    and reset the resident high water mark.  The pages remain committed.
+ *    Until the next mem_ctx_reset_brk, the peak is also sampled before
+ *    mem_ctx_release gives pages back.
+ */
+void mem_ctx_reset_resident(mem_ctx_t *ctx)
+{
+    if (!ctx->locked && ctx->commit_brk > ctx->start_brk)
+	madvise(ctx->start_brk, ctx->commit_brk - ctx->start_brk,
+		MADV_DONTNEED);
+    ctx->peak_resident = 0;
+    ctx->track_resident = 1;
+}
+
+/*
+ * mem_commit - make the heap accessible up to (at least) new_brk.  Returns
+ *    0 on success and -1 if the pages could not be committed.
+ */
+static int mem_commit(mem_ctx_t *ctx, char *new_brk)
+{
+    char *new_commit;
+
+    new_commit = ctx->start_brk +
+	((new_brk - ctx->start_brk + COMMIT_CHUNK - 1)
+	 / COMMIT_CHUNK * COMMIT_CHUNK);
+    if (new_commit > ctx->max_addr)
+	new_commit = ctx->max_addr;
+    if (mprotect(ctx->commit_brk, new_commit - ctx->commit_brk,
+		 PROT_READ | PROT_WRITE) < 0)
+	return -1;
+    ctx->commit_brk = new_commit;
+    return 0;
+}
+
+/* 
+ * mem_ctx_sbrk - simple model of the sbrk function. Extends the heap 
+ *    by incr bytes and returns the start address of the new area. In
+ *    this model, the heap cannot be shrunk.
+ */
+void *mem_ctx_sbrk(mem_ctx_t *ctx, intptr_t incr) 
+{
+    char *old_brk = ctx->brk;
+    size_t pagesize, new_pages;
+
+    if ( (incr < 0) || (incr > ctx->max_addr - ctx->brk) ||
+	 ((ctx->brk + incr > ctx->commit_brk) &&
+	  mem_commit(ctx, ctx->brk + incr) < 0)) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    ctx->brk += incr;
+
+    /* Charge for the call and for every page the heap grew into */
+    if (sbrk_call_ns > 0 || sbrk_page_ns > 0) {
+	pagesize = mem_pagesize();
+	new_pages = (ctx->brk - ctx->start_brk + pagesize - 1) / pagesize -
+	    (old_brk - ctx->start_brk + pagesize - 1) / pagesize;
+	mem_spin(sbrk_call_ns + new_pages * sbrk_page_ns);
+    }
+    return (void *)old_brk;
+}
+
+/*
+ * mem_ctx_release - give the physical pages that lie entirely within
+ *    [addr, addr+len) back to the system.  The range stays part of the
+ *    heap: reading it yields zeros and writing it commits fresh pages.
+ */
+void mem_ctx_release(mem_ctx_t *ctx, void *addr, size_t len)
+{
+    size_t pagesize = mem_pagesize();
+    char *lo = (char *)addr;
+    char *hi = lo + len;
+
+    /* Only whole pages inside the current heap can be released */
+    if (lo < ctx->start_brk)
+	lo = ctx->start_brk;
+    if (hi > ctx->brk)
+	hi = ctx->brk;
+    lo = ctx->start_brk + (lo - ctx->start_brk + pagesize - 1) /
+	pagesize * pagesize;
+    hi = ctx->start_brk + (hi - ctx->start_brk) / pagesize * pagesize;
+    if (hi <= lo || ctx->locked)
+	return;
+
+    /* Residency only ever drops here, so sample the peak first */
+    if (ctx->track_resident)
+	mem_ctx_resident_bytes(ctx);
+    madvise(lo, hi - lo, MADV_DONTNEED);
+}
+
+/*
+ * mem_ctx_lock - commit the whole heap, fault in all of its pages and
+ *    lock them in memory.  Locked pages are never given back, so neither
+ *    mem_ctx_release nor mem_ctx_reset_resident drops them, and fresh
+ *    pages are not handed out.  Returns 0 on success and -1 on error.
+ */
+int mem_ctx_lock(mem_ctx_t *ctx)
+{
+    if (ctx->commit_brk < ctx->max_addr && mem_commit(ctx, ctx->max_addr) < 0)
+	return -1;
+    if (mlock(ctx->start_brk, ctx->max_heap) < 0)
+	return -1;
+    ctx->locked = 1;
+    return 0;
+}
+
+/*
+ * mem_ctx_heap_lo - return address of the first heap byte
+ */
+void *mem_ctx_heap_lo(mem_ctx_t *ctx)
+{
+    return (void *)ctx->start_brk;
+}
+
+/* 
+ * mem_ctx_heap_hi - return address of last heap byte
+ */
+void *mem_ctx_heap_hi(mem_ctx_t *ctx)
+{
+    return (void *)(ctx->brk - 1);
+}
+
+/*
+ * mem_ctx_heapsize - returns the heap size in bytes
+ */
+size_t mem_ctx_heapsize(mem_ctx_t *ctx) 
+{
+    return (size_t)(ctx->brk - ctx->start_brk);
+}
+
+/* 
+ * mem_ctx_maxheap - return the maximum heap size in bytes
+ */
+size_t mem_ctx_maxheap(mem_ctx_t *ctx)
+{
+    return ctx->max_heap;
+}
+
+/*
+ * mem_ctx_resident_bytes - returns the number of heap bytes that are
+ *    currently backed by physical memory, i.e., the heap's share of the
+ *    resident set size.  Also updates the resident high water mark.
+ */
+size_t mem_ctx_resident_bytes(mem_ctx_t *ctx)
+{
+    size_t pagesize = mem_pagesize();
+    size_t npages = (ctx->commit_brk - ctx->start_brk) / pagesize;
+    size_t i, resident = 0;
+
+    if (npages == 0)
+	return 0;
+    if (mincore(ctx->start_brk, npages * pagesize, ctx->pagevec) < 0) {
+	fprintf(stderr, "mem_resident_bytes: mincore error: %s\n",
+		strerror(errno));
+	exit(1);
+    }
+    for (i = 0; i < npages; i++)
+	resident += ctx->pagevec[i] & 1;
+    resident *= pagesize;
+
+    if (resident > ctx->peak_resident)
+	ctx->peak_resident = resident;
+    return resident;
+}
+
+/*
+ * mem_ctx_peak_resident_bytes - returns the largest resident heap size
+ *    seen by mem_ctx_resident_bytes since the last reset.  Pages only
+ *    become resident by being touched and mem_ctx_release samples the
+ *    resident size before it gives pages back, so calling this at the end
+ *    of a run yields the true peak.
+ */
+size_t mem_ctx_peak_resident_bytes(mem_ctx_t *ctx)
+{
+    mem_ctx_resident_bytes(ctx);
+    return ctx->peak_resident;
+}
+
+/*
+ * The following routines operate on the default heap.
+ */
+
+/* 
+ * mem_default_ctx - return the context of the default heap
+ */
+mem_ctx_t *mem_default_ctx(void)
+{
+    return &mem_default;
+}
+
+/* 
+ * mem_set_maxheap - set the maximum size in bytes of the default heap.
+ *    Must be called before mem_init.
+ */
+void mem_set_maxheap(size_t size)
+{
+    assert(mem_default.start_brk == NULL);
+    mem_default.max_heap = size;
+}
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    if (mem_ctx_setup(&mem_default, mem_default.max_heap) < 0) {
+	fprintf(stderr, "mem_init_vm: %s\n", strerror(errno));
 	exit(1);
     }
-
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
 }
 
 /* 
@@ -39,7 +410,7 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_ctx_teardown(&mem_default);
 }
 
 /*
@@ -47,25 +418,43 @@ void mem_deinit(void)
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mem_ctx_reset_brk(&mem_default);
 }
 
-/* 
+/*
+ * mem_reset_resident - drop the default heap's pages from memory, see
+ *    mem_ctx_reset_resident
+ */
+void mem_reset_resident(void)
+{
+    mem_ctx_reset_resident(&mem_default);
+}
+
+/*
+ * mem_lock - lock the default heap in memory, see mem_ctx_lock
+ */
+int mem_lock(void)
+{
+    return mem_ctx_lock(&mem_default);
+}
+
+/*
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
  *    by incr bytes and returns the start address of the new area. In
  *    this model, the heap cannot be shrunk.
  */
 void *mem_sbrk(intptr_t incr) 
 {
-    char *old_brk = mem_brk;
+    return mem_ctx_sbrk(&mem_default, incr);
+}
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-	return (void *)-1;
-    }
-    mem_brk += incr;
-    return (void *)old_brk;
+/*
+ * mem_release - give the pages within [addr, addr+len) of the default
+ *    heap back to the system, see mem_ctx_release
+ */
+void mem_release(void *addr, size_t len)
+{
+    mem_ctx_release(&mem_default, addr, len);
 }
 
 /*
@@ -73,7 +462,7 @@ void *mem_sbrk(intptr_t incr)
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_ctx_heap_lo(&mem_default);
 }
 
 /* 
@@ -81,7 +470,7 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_ctx_heap_hi(&mem_default);
 }
 
 /*
@@ -89,7 +478,32 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_ctx_heapsize(&mem_default);
+}
+
+/*
+ * mem_maxheap - return the maximum heap size in bytes
+ */
+size_t mem_maxheap(void)
+{
+    return mem_ctx_maxheap(&mem_default);
+}
+
+/*
+ * mem_resident_bytes - returns the number of resident heap bytes
+ */
+size_t mem_resident_bytes()
+{
+    return mem_ctx_resident_bytes(&mem_default);
+}
+
+/*
+ * mem_peak_resident_bytes - returns the largest resident heap size
+ *    since the last reset
+ */
+size_t mem_peak_resident_bytes()
+{
+    return mem_ctx_peak_resident_bytes(&mem_default);
 }
 
 /*
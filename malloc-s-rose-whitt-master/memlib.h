@@ -1,8 +1,39 @@
+/* The state of one simulated heap; see memlib.c */
+typedef struct mem_ctx mem_ctx_t;
+
+/* Operations on the default heap */
 void mem_init(void);               
 void mem_deinit(void);
+void mem_set_maxheap(size_t size);
+size_t mem_maxheap(void);
 void *mem_sbrk(intptr_t incr);
 void mem_reset_brk(void); 
+void mem_release(void *addr, size_t len);
+int mem_lock(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+void mem_reset_resident(void);
+size_t mem_resident_bytes(void);
+size_t mem_peak_resident_bytes(void);
 size_t mem_pagesize(void);
+
+/* Optional cost model for heap growth; applies to all heaps */
+void mem_set_sbrk_cost(double ns_per_call, double ns_per_page);
+void mem_set_fresh_pages(int fresh);
+
+/* Operations on an explicit heap */
+mem_ctx_t *mem_default_ctx(void);
+mem_ctx_t *mem_ctx_create(size_t max_heap);
+void mem_ctx_destroy(mem_ctx_t *ctx);
+void *mem_ctx_sbrk(mem_ctx_t *ctx, intptr_t incr);
+void mem_ctx_reset_brk(mem_ctx_t *ctx);
+void mem_ctx_release(mem_ctx_t *ctx, void *addr, size_t len);
+int mem_ctx_lock(mem_ctx_t *ctx);
+void *mem_ctx_heap_lo(mem_ctx_t *ctx);
+void *mem_ctx_heap_hi(mem_ctx_t *ctx);
+size_t mem_ctx_heapsize(mem_ctx_t *ctx);
+size_t mem_ctx_maxheap(mem_ctx_t *ctx);
+void mem_ctx_reset_resident(mem_ctx_t *ctx);
+size_t mem_ctx_resident_bytes(mem_ctx_t *ctx);
+size_t mem_ctx_peak_resident_bytes(mem_ctx_t *ctx);
@@ -50,6 +50,7 @@ struct seg_list
 #define DSIZE (2 * WSIZE)	 /* Doubleword size (bytes) */
 #define ALIGN_SIZE 8		 /* Alignment size */
 #define CHUNKSIZE (1 << 12)	 /* Extend heap by this amount (bytes) */
+#define RELEASE_SIZE (1 << 20) /* Give back pages of free blocks this big */
 
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
 
@@ -64,6 +65,16 @@ struct seg_list
 #define GET_SIZE(p) (GET(p) & ~(ALIGN_SIZE - 1))
 #define GET_ALLOC(p) (GET(p) & 0x1)
 
+/*
+ * A free block of at least RELEASE_SIZE bytes whose pages are given back to
+ * the memory system carries the RELEASED bit in its header and footer.  The
+ * word after its free list links counts the bytes of the block that may
+ * have been touched since its pages were last given back.
+ */
+#define RELEASED 0x2
+#define GET_RELEASED(p) (GET(p) & RELEASED)
+#define DIRTYP(bp) ((char *)(bp) + sizeof(struct seg_list))
+
 /* Given block ptr bp, compute address of its header and footer. */
 #define HDRP(bp) ((char *)(bp)-WSIZE)
 #define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
@@ -80,6 +91,7 @@ static void *coalesce(void *bp);
 static void *extend_heap(size_t words);
 static void *find_fit(size_t asize);
 static void place(void *bp, size_t asize);
+static size_t release(void *bp, size_t size, size_t dirty);
 
 /* Pointer to first free block of each free list */
 static struct seg_list *free_listp;
@@ -248,7 +260,7 @@ mm_realloc(void *ptr, size_t size)
 		return (mm_malloc(size));
 
 	/* Copy the old data. */
-	if (newsize < oldsize)
+	if (newsize <= oldsize)
 		return (ptr);
 
 	newptr = mm_malloc(2 * size);
@@ -257,7 +269,7 @@ mm_realloc(void *ptr, size_t size)
 	if (newptr == NULL)
 		return (NULL);
 
-	memcpy(newptr, ptr, oldsize);
+	memcpy(newptr, ptr, oldsize - DSIZE);
 
 	/* Free the old block. */
 	mm_free(ptr);
@@ -265,6 +277,25 @@ mm_realloc(void *ptr, size_t size)
 	return (newptr);
 }
 
+/*
+ * Requires:
+ *   "visit" does not call into the memory manager.
+ *
+ * Effects:
+ *   Calls "visit" on every block in the heap, in address order, with the
+ *   block's address, its size including the header and footer, and
+ *   whether it is allocated.  The prologue and epilogue are skipped.
+ */
+void
+mm_heapwalk(mm_visit_t visit, void *arg)
+{
+	void *bp;
+
+	for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0;
+		 bp = NEXT_BLKP(bp))
+		visit(bp, GET_SIZE(HDRP(bp)), GET_ALLOC(HDRP(bp)), arg);
+}
+
 /*
  * The following routines are internal helper routines.
  */
@@ -288,6 +319,15 @@ coalesce(void *bp)
 	/* Reduces repeated code */
 	struct seg_list *new_free;
 
+	/* Count the bytes of the joined block that may still be resident */
+	size_t dirty = size;
+	if (!prev_alloc)
+		dirty += GET_RELEASED(FTRP(PREV_BLKP(bp))) ?
+		    GET(DIRTYP(PREV_BLKP(bp))) : GET_SIZE(FTRP(PREV_BLKP(bp)));
+	if (!next_alloc)
+		dirty += GET_RELEASED(HDRP(NEXT_BLKP(bp))) ?
+		    GET(DIRTYP(NEXT_BLKP(bp))) : GET_SIZE(HDRP(NEXT_BLKP(bp)));
+
 	if (prev_alloc && next_alloc)
 	{ /* Case 1 : Previous and Next blocks are allocated */
 		/* No joining, no remove necessary */
@@ -350,6 +390,13 @@ coalesce(void *bp)
 		new_free = (struct seg_list *)bp;
 	}
 
+	/* Give back the pages of a large block and record that in its tags */
+	size_t released = release(bp, size, dirty);
+	PUT(HDRP(bp), PACK(size, released));
+	PUT(FTRP(bp), PACK(size, released));
+	if (released)
+		PUT(DIRTYP(bp), dirty < RELEASE_SIZE ? dirty : 0);
+
 	/* Insert joined block into the correct free list */
 	insert_circular(new_free, &free_listp[find_list_head(size)]);
 
@@ -436,13 +483,16 @@ find_fit(size_t asize)
  * Effects:
  *   Place a block of "asize" bytes at the start of the free block "bp" and
  *   split that block if the remainder would be at least the minimum block
- *   size. 
+ *   size.  A large remainder split from a released block stays released;
+ *   only the pages that the placed block touches are committed again.
  */
 static void
 place(void *bp, size_t asize)
 {
 
 	size_t csize = GET_SIZE(HDRP(bp));
+	size_t released = GET_RELEASED(HDRP(bp));
+	size_t dirty = released ? GET(DIRTYP(bp)) : 0;
 
 	remove_circular(bp);
 
@@ -455,9 +505,15 @@ place(void *bp, size_t asize)
 
 		bp = NEXT_BLKP(bp);
 
-		PUT(HDRP(bp), PACK(csize - asize, 0));
+		if (csize - asize < RELEASE_SIZE)
+			released = 0;
+
+		PUT(HDRP(bp), PACK(csize - asize, released));
+
+		PUT(FTRP(bp), PACK(csize - asize, released));
 
-		PUT(FTRP(bp), PACK(csize - asize, 0));
+		if (released)
+			PUT(DIRTYP(bp), dirty);
 
 		unsigned int head_ptr = find_list_head(csize - asize);
 
@@ -472,6 +528,32 @@ place(void *bp, size_t asize)
 	}
 }
 
+/*
+ * Requires:
+ *   "bp" is the address of a free block of "size" bytes, at most "dirty"
+ *   bytes of which have been touched since they were last released.
+ *
+ * Effects:
+ *   Returns RELEASED if the block is at least RELEASE_SIZE bytes and lies
+ *   in the interior of the heap, and 0 otherwise.  The block at the end of
+ *   the heap is excluded because it is where the heap grows, so its pages
+ *   would be touched again almost at once.  To keep system calls rare, the
+ *   pages of a released block's interior (everything but its tags, links
+ *   and dirty count) are only given back to the memory system once
+ *   RELEASE_SIZE of its bytes are dirty.
+ */
+static size_t
+release(void *bp, size_t size, size_t dirty)
+{
+
+	if (size < RELEASE_SIZE || GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0)
+		return (0);
+	if (dirty >= RELEASE_SIZE)
+		mem_release(DIRTYP(bp) + WSIZE,
+		    size - sizeof(struct seg_list) - WSIZE - DSIZE);
+	return (RELEASED);
+}
+
 /* 
  * The remaining routines are heap consistency checker routines.
  */
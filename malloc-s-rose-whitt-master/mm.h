@@ -7,6 +7,14 @@ void	*mm_malloc(size_t size);
 void	 mm_free(void *ptr);
 void	*mm_realloc(void *ptr, size_t size);
 
+/*
+ * mm_heapwalk calls a visitor on each block of the heap, so that mdriver
+ * can sample how the heap is laid out (-u).
+ */
+typedef void (*mm_visit_t)(void *bp, size_t size, int allocated, void *arg);
+
+void	 mm_heapwalk(mm_visit_t visit, void *arg);
+
 /*
  * Students work in teams of one or two.  Teams enter their team name, personal
  * names and login IDs in a struct of this type in their mm.c file.
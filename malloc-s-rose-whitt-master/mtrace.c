@@ -0,0 +1,609 @@
+/*
+ * mtrace.c - record the allocation requests of a running program
+ *
+ * Preload libmtrace.so into any dynamically linked program:
+ *
+ *     LD_PRELOAD=./libmtrace.so MTRACE_OUT=app.rep ./app
+ *
+ * malloc, calloc, realloc and free are wrapped, and at exit every
+ * request is written to MTRACE_OUT (default mtrace.rep) as a threaded
+ * trace (see trace.h) that mdriver can replay through mm_malloc.  A %p
+ * in MTRACE_OUT is replaced by the process id, so that programs that
+ * start other programs leave one trace per process.  Each
+ * allocation gets an id of its own.  A realloc by a thread that did not
+ * allocate the block is recorded as a free and a fresh allocation,
+ * since only a block's owner may realloc it in a trace.  Blocks from
+ * memalign and friends are not recorded, and neither are their frees.
+ *
+ * Recording must not serialize the program, so nothing here takes a
+ * lock.  Each thread appends requests to a buffer of its own, tagged
+ * with a global sequence number.  Full buffers are pushed onto a
+ * lock-free stack, and a flusher thread appends them to a spool file.
+ * At exit the spool is sorted back into sequence order and written out
+ * as text.  Block addresses are mapped to ids with a lock-free open
+ * addressing hash table.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define BUF_RECS   4096      /* requests per thread buffer */
+#define TABLE_BITS 22        /* log2 of the slots in the address table */
+#define TABLE_SIZE (1UL << TABLE_BITS)
+#define MAX_PROBE  4096      /* most slots an address may be from its hash */
+#define BOOT_SIZE  8192      /* bytes for allocations made while starting */
+#define FLUSH_NS   10000000  /* how often the flusher looks for work */
+
+/* Kinds of recorded requests */
+enum {R_ALLOC, R_REALLOC, R_FREE, R_FREE_OTHER};
+
+/* A recorded request */
+typedef struct {
+    uint64_t seq;             /* position in the order of all requests */
+    uint32_t tid;             /* thread that made it */
+    uint32_t type;            /* R_xxx */
+    uint32_t id;              /* block it allocated, resized or freed */
+    uint32_t size;            /* requested size in bytes */
+} rec_t;
+
+/* A thread's buffer of requests */
+typedef struct buf {
+    struct buf *next;         /* next buffer on the stack of full buffers */
+    unsigned count;           /* number of requests in recs */
+    rec_t recs[BUF_RECS];
+} buf_t;
+
+/* The recording state of one thread */
+typedef struct thr {
+    struct thr *next;         /* next thread on the list of all threads */
+    buf_t *cur;               /* buffer the thread is filling */
+    uint32_t tid;             /* thread id in the trace */
+} thr_t;
+
+/* A slot of the address table */
+typedef struct {
+    uintptr_t key;            /* block address, EMPTY or DELETED */
+    uint32_t id;              /* the block's id... */
+    uint32_t owner;           /* ... and the thread that allocated it */
+} slot_t;
+#define EMPTY   0
+#define DELETED 1
+
+/* The functions that are being wrapped */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+
+/* dlsym allocates memory before the real functions are known */
+static char boot[BOOT_SIZE] __attribute__((aligned(16)));
+static size_t boot_used;
+#define IS_BOOT(p) ((char *)(p) >= boot && (char *)(p) < boot + BOOT_SIZE)
+
+static int recording;         /* are requests being recorded? */
+static uint64_t next_seq;     /* sequence number of the next request */
+static uint32_t next_id;      /* id of the next block */
+static uint32_t next_tid;     /* id of the next thread */
+static unsigned long dropped; /* allocations that did not fit the table */
+static slot_t *table;         /* the address table */
+static buf_t *full;           /* stack of full buffers */
+static thr_t *threads;        /* list of every thread that recorded */
+static pthread_t flusher;
+static int flusher_stop;      /* tells the flusher to quit */
+static int spool = -1;        /* file the flusher writes buffers to */
+static char out_path[PATH_MAX];
+static char spool_path[PATH_MAX + 32];
+
+/* Per-thread state; busy keeps the library from recording itself */
+static __thread thr_t *self __attribute__((tls_model("initial-exec")));
+static __thread int busy __attribute__((tls_model("initial-exec")));
+
+static void resolve(void);
+static void *boot_alloc(size_t size);
+static thr_t *get_self(void);
+static buf_t *new_buf(void);
+static void log_req(thr_t *t, uint32_t type, uint32_t id, size_t size);
+static void record_alloc(void *p, size_t size);
+static int table_insert(void *p, uint32_t id, uint32_t owner);
+static int table_remove(void *p, uint32_t *id, uint32_t *owner);
+static void *flush_loop(void *arg);
+static void spool_buf(buf_t *b, unsigned count);
+static void write_trace(void);
+static int cmp_seq(const void *a, const void *b);
+static void mtrace_child(void);
+static void note(char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/**********************
+ * The wrapped functions
+ **********************/
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (real_malloc == NULL && (resolve(), real_malloc == NULL))
+	return boot_alloc(size);
+    if (busy || !recording)
+	return real_malloc(size);
+    busy = 1;
+    if ((p = real_malloc(size)) != NULL)
+	record_alloc(p, size);
+    busy = 0;
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (real_calloc == NULL && (resolve(), real_calloc == NULL))
+	return boot_alloc(nmemb * size); /* boot is already zero */
+    if (busy || !recording)
+	return real_calloc(nmemb, size);
+    busy = 1;
+    if ((p = real_calloc(nmemb, size)) != NULL)
+	record_alloc(p, nmemb * size);
+    busy = 0;
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+    uint32_t id, owner;
+    int found;
+    thr_t *t;
+
+    if (real_realloc == NULL && (resolve(), real_realloc == NULL))
+	return boot_alloc(size);
+    if (IS_BOOT(ptr)) { /* the size of a boot block is not known */
+	if ((p = malloc(size)) != NULL)
+	    memcpy(p, ptr, size < (size_t)(boot + BOOT_SIZE - (char *)ptr) ?
+		   size : (size_t)(boot + BOOT_SIZE - (char *)ptr));
+	return p;
+    }
+    if (busy || !recording || ptr == NULL)
+	return (ptr == NULL) ? malloc(size) : real_realloc(ptr, size);
+
+    busy = 1;
+    t = get_self();
+
+    /* Forget the old address before another thread can be given it */
+    if ((found = table_remove(ptr, &id, &owner)) && size == 0)
+	log_req(t, (owner == t->tid) ? R_FREE : R_FREE_OTHER, id, 0);
+    p = real_realloc(ptr, size);
+
+    if (p == NULL) {
+	if (found && size > 0) /* the old block is still allocated */
+	    table_insert(ptr, id, owner);
+    }
+    else if (!found || size == 0 || size > INT_MAX)
+	record_alloc(p, size);
+    else if (owner == t->tid) {
+	if (table_insert(p, id, owner))
+	    log_req(t, R_REALLOC, id, size);
+	else
+	    __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+    }
+    else {
+	log_req(t, R_FREE_OTHER, id, 0);
+	record_alloc(p, size);
+    }
+    busy = 0;
+    return p;
+}
+
+void free(void *ptr)
+{
+    uint32_t id, owner;
+    thr_t *t;
+
+    if (ptr == NULL || IS_BOOT(ptr))
+	return;
+    if (real_free == NULL && (resolve(), real_free == NULL))
+	return;
+    if (busy || !recording) {
+	real_free(ptr);
+	return;
+    }
+    busy = 1;
+    if (table_remove(ptr, &id, &owner)) {
+	t = get_self();
+	log_req(t, (owner == t->tid) ? R_FREE : R_FREE_OTHER, id, 0);
+    }
+    real_free(ptr);
+    busy = 0;
+}
+
+/******************
+ * Recording helpers
+ ******************/
+
+/*
+ * resolve - look up the real allocation functions.  dlsym may itself
+ *     allocate, and those requests are served from boot.
+ */
+static void resolve(void)
+{
+    static int resolving;
+
+    if (resolving)
+	return;
+    resolving = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    resolving = 0;
+}
+
+/*
+ * boot_alloc - allocate from boot.  Its blocks are never freed.
+ */
+static void *boot_alloc(size_t size)
+{
+    size_t off;
+
+    size = (size + 15) & ~(size_t)15;
+    off = __atomic_fetch_add(&boot_used, size, __ATOMIC_RELAXED);
+    return (off + size <= BOOT_SIZE) ? boot + off : NULL;
+}
+
+/*
+ * get_self - return the calling thread's state, creating it (and its
+ *     trace thread id) on the thread's first request
+ */
+static thr_t *get_self(void)
+{
+    thr_t *t;
+
+    if (self != NULL)
+	return self;
+    t = mmap(NULL, sizeof(thr_t), PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (t == MAP_FAILED)
+	abort();
+    t->tid = __atomic_fetch_add(&next_tid, 1, __ATOMIC_RELAXED);
+    t->cur = new_buf();
+    t->next = __atomic_load_n(&threads, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&threads, &t->next, t, 1,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	;
+    return self = t;
+}
+
+/*
+ * new_buf - map an empty buffer.  Buffers are mapped rather than
+ *     malloc'ed so that recording never calls the wrapped functions.
+ */
+static buf_t *new_buf(void)
+{
+    buf_t *b = mmap(NULL, sizeof(buf_t), PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (b == MAP_FAILED)
+	abort();
+    return b;
+}
+
+/*
+ * log_req - append a request to the thread's buffer, handing the buffer
+ *     to the flusher when it fills up.  A block's requests are ordered
+ *     by the program itself, so their sequence numbers are in the same
+ *     order even though they are taken with relaxed atomics.
+ */
+static void log_req(thr_t *t, uint32_t type, uint32_t id, size_t size)
+{
+    buf_t *b = t->cur;
+    rec_t *r = &b->recs[b->count];
+
+    r->seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    r->tid = t->tid;
+    r->type = type;
+    r->id = id;
+    r->size = (size == 0 && type <= R_REALLOC) ? 1 : size;
+    __atomic_store_n(&b->count, b->count + 1, __ATOMIC_RELEASE);
+
+    if (b->count == BUF_RECS) {
+	__atomic_store_n(&t->cur, new_buf(), __ATOMIC_RELEASE);
+	b->next = __atomic_load_n(&full, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&full, &b->next, b, 1,
+					    __ATOMIC_RELEASE,
+					    __ATOMIC_RELAXED))
+	    ;
+    }
+}
+
+/*
+ * record_alloc - give a newly allocated block an id and record it.
+ *     Blocks that a trace cannot describe are left out.
+ */
+static void record_alloc(void *p, size_t size)
+{
+    thr_t *t = get_self();
+    uint32_t id;
+
+    if (size > INT_MAX)
+	return;
+    id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    if (table_insert(p, id, t->tid))
+	log_req(t, R_ALLOC, id, size);
+    else
+	__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+}
+
+/* Home slot of address p in the table */
+#define HASH(p) ((size_t)((((uintptr_t)(p) >> 4) * 0x9E3779B97F4A7C15ULL) \
+			  >> (64 - TABLE_BITS)))
+
+/*
+ * table_insert - map address p to a block.  Returns 0 if every nearby
+ *     slot is taken.  No other thread can look p up before the caller
+ *     returns it, so the id and owner may be filled in after the key.
+ */
+static int table_insert(void *p, uint32_t id, uint32_t owner)
+{
+    size_t i = HASH(p), n;
+    uintptr_t key;
+
+    for (n = 0; n < MAX_PROBE; n++, i = (i + 1) & (TABLE_SIZE - 1)) {
+	key = __atomic_load_n(&table[i].key, __ATOMIC_RELAXED);
+	if ((key == EMPTY || key == DELETED) &&
+	    __atomic_compare_exchange_n(&table[i].key, &key, (uintptr_t)p, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+	    table[i].id = id;
+	    table[i].owner = owner;
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/*
+ * table_remove - look up address p and remove it from the table.
+ *     Returns 0 if p was never recorded.
+ */
+static int table_remove(void *p, uint32_t *id, uint32_t *owner)
+{
+    size_t i = HASH(p), n;
+    uintptr_t key;
+
+    for (n = 0; n < MAX_PROBE; n++, i = (i + 1) & (TABLE_SIZE - 1)) {
+	key = __atomic_load_n(&table[i].key, __ATOMIC_ACQUIRE);
+	if (key == (uintptr_t)p) {
+	    *id = table[i].id;
+	    *owner = table[i].owner;
+	    __atomic_store_n(&table[i].key, DELETED, __ATOMIC_RELEASE);
+	    return 1;
+	}
+	if (key == EMPTY)
+	    return 0;
+    }
+    return 0;
+}
+
+/**********************
+ * Flushing and writing
+ **********************/
+
+/*
+ * flush_loop - the flusher thread: now and then, take every full
+ *     buffer off the stack and append it to the spool file
+ */
+static void *flush_loop(void *arg)
+{
+    struct timespec nap = {0, FLUSH_NS};
+    buf_t *b, *next;
+    int stop;
+
+    (void)arg;
+    busy = 1;
+    do {
+	nanosleep(&nap, NULL);
+	stop = __atomic_load_n(&flusher_stop, __ATOMIC_ACQUIRE);
+	b = __atomic_exchange_n(&full, NULL, __ATOMIC_ACQUIRE);
+	for (; b != NULL; b = next) {
+	    next = b->next;
+	    spool_buf(b, BUF_RECS);
+	    munmap(b, sizeof(buf_t));
+	}
+    } while (!stop);
+    return NULL;
+}
+
+/*
+ * spool_buf - append the first count requests of a buffer to the spool
+ */
+static void spool_buf(buf_t *b, unsigned count)
+{
+    char *p = (char *)b->recs;
+    size_t left = count * sizeof(rec_t);
+    ssize_t n;
+
+    while (left > 0) {
+	if ((n = write(spool, p, left)) <= 0) {
+	    note("mtrace: could not write %s\n", spool_path);
+	    _exit(1);
+	}
+	p += n;
+	left -= n;
+    }
+}
+
+/*
+ * write_trace - sort the spooled requests and write them as a trace.
+ *     A thread may have taken a sequence number without storing its
+ *     request before recording stopped, so the trace ends at the first
+ *     missing number: every request before it is complete.
+ */
+static void write_trace(void)
+{
+    struct stat st;
+    rec_t *recs;
+    size_t i, n;
+    FILE *out;
+    static const char type[] = {'a', 'r', 'f', 'F'};
+
+    if (fstat(spool, &st) < 0) {
+	note("mtrace: could not read %s\n", spool_path);
+	return;
+    }
+    n = st.st_size / sizeof(rec_t);
+    recs = (n == 0) ? NULL :
+	mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, spool, 0);
+    if (recs == MAP_FAILED) {
+	note("mtrace: could not map %s\n", spool_path);
+	return;
+    }
+    if (n > 0)
+	qsort(recs, n, sizeof(rec_t), cmp_seq);
+    for (i = 0; i < n && recs[i].seq == i; i++)
+	;
+    n = i;
+
+    if ((out = fopen(out_path, "w")) == NULL) {
+	note("mtrace: could not open %s\n", out_path);
+	return;
+    }
+    fprintf(out, "0\n%u\n%zu\n1\n%u\n", next_id, n,
+	    next_tid > 0 ? next_tid : 1);
+    for (i = 0; i < n; i++) {
+	if (recs[i].type <= R_REALLOC)
+	    fprintf(out, "%u %c %u %u\n", recs[i].tid, type[recs[i].type],
+		    recs[i].id, recs[i].size);
+	else
+	    fprintf(out, "%u %c %u\n", recs[i].tid, type[recs[i].type],
+		    recs[i].id);
+    }
+    if (fclose(out) != 0)
+	note("mtrace: could not write %s\n", out_path);
+    else
+	note("mtrace: wrote %zu requests by %u threads to %s\n",
+	     n, next_tid, out_path);
+    if (dropped > 0)
+	note("mtrace: %lu allocations did not fit the address table\n",
+	     dropped);
+    if (recs != NULL)
+	munmap(recs, st.st_size);
+}
+
+/*
+ * cmp_seq - order requests by sequence number
+ */
+static int cmp_seq(const void *a, const void *b)
+{
+    uint64_t x = ((const rec_t *)a)->seq, y = ((const rec_t *)b)->seq;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * note - print a message on stderr without going through stdio's buffers
+ */
+static void note(char *fmt, ...)
+{
+    char line[PATH_MAX + 128];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (n > 0 && write(2, line, (size_t)n < sizeof(line) ? (size_t)n
+		       : sizeof(line) - 1) < 0)
+	return;
+}
+
+/*********************
+ * Starting and ending
+ *********************/
+
+/*
+ * mtrace_init - set up the table and the spool and start the flusher
+ */
+static void __attribute__((constructor)) mtrace_init(void)
+{
+    char *path, *q;
+    size_t n = 0;
+
+    busy = 1;
+    resolve();
+    if ((path = getenv("MTRACE_OUT")) == NULL)
+	path = "mtrace.rep";
+    for (q = path; *q != '\0' && n < sizeof(out_path) - 16; q++) {
+	if (q[0] == '%' && q[1] == 'p') {
+	    n += sprintf(out_path + n, "%d", (int)getpid());
+	    q++;
+	}
+	else
+	    out_path[n++] = *q;
+    }
+    out_path[n] = '\0';
+    snprintf(spool_path, sizeof(spool_path), "%s.%d.spool", out_path,
+	     (int)getpid());
+
+    table = mmap(NULL, TABLE_SIZE * sizeof(slot_t), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    spool = open(spool_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (table == MAP_FAILED || spool < 0) {
+	note("mtrace: could not start, so nothing will be recorded\n");
+	busy = 0;
+	return;
+    }
+    pthread_atfork(NULL, NULL, mtrace_child);
+    if (pthread_create(&flusher, NULL, flush_loop, NULL) != 0) {
+	note("mtrace: could not start the flusher\n");
+	busy = 0;
+	return;
+    }
+    busy = 0;
+    __atomic_store_n(&recording, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * mtrace_fini - stop recording, spool what the flusher has not, and
+ *     write the trace
+ */
+static void __attribute__((destructor)) mtrace_fini(void)
+{
+    thr_t *t;
+    buf_t *b;
+
+    if (!__atomic_exchange_n(&recording, 0, __ATOMIC_ACQ_REL))
+	return;
+    busy = 1;
+    __atomic_store_n(&flusher_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(flusher, NULL);
+
+    for (b = __atomic_exchange_n(&full, NULL, __ATOMIC_ACQUIRE); b != NULL;
+	 b = b->next)
+	spool_buf(b, BUF_RECS);
+    for (t = __atomic_load_n(&threads, __ATOMIC_ACQUIRE); t != NULL;
+	 t = t->next) {
+	b = __atomic_load_n(&t->cur, __ATOMIC_ACQUIRE);
+	spool_buf(b, __atomic_load_n(&b->count, __ATOMIC_ACQUIRE));
+    }
+
+    write_trace();
+    close(spool);
+    unlink(spool_path);
+}
+
+/*
+ * mtrace_child - a forked child has no flusher, so it records nothing
+ */
+static void mtrace_child(void)
+{
+    recording = 0;
+}
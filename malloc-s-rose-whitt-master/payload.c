@@ -0,0 +1,233 @@
+/*
+ * payload.c - Fill and check mdriver's block payloads.
+ *
+ * The checks run after every realloc in eval_mm_valid, and for large
+ * blocks they dominate validation time. So besides the plain C
+ * kernels there are SSE2 and AVX2 kernels that handle 64 bytes per
+ * step, with the C kernels finishing off any tail. payload_init picks
+ * the widest one the CPU supports.
+ *
+ * A vector of pattern bytes advances by a constant from one step to
+ * the next: adding 64*step to each byte moves the vector 64 positions
+ * along the pattern, and 8-bit lanes wrap mod 256 just like the
+ * pattern does.
+ */
+#include <stdio.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "payload.h"
+
+typedef void (*fill_funct)(unsigned char *, size_t, size_t,
+			   unsigned char, unsigned char);
+typedef size_t (*check_funct)(const unsigned char *, size_t, size_t,
+			      unsigned char, unsigned char);
+
+static void fill_c(unsigned char *p, size_t from, size_t to,
+		   unsigned char seed, unsigned char step);
+static size_t check_c(const unsigned char *p, size_t from, size_t to,
+		      unsigned char seed, unsigned char step);
+
+static fill_funct fill = fill_c;
+static check_funct check = check_c;
+static const char *kernel = "C";
+
+/*
+ * fill_c - store pattern bytes [from, to) one at a time
+ */
+static void fill_c(unsigned char *p, size_t from, size_t to,
+		   unsigned char seed, unsigned char step)
+{
+    size_t j;
+
+    if (step == 0) {
+	memset(p + from, seed, to - from);
+	return;
+    }
+    for (j = from; j < to; j++)
+	p[j] = (unsigned char)(seed + step * j);
+}
+
+/*
+ * check_c - return the first position in [from, to) that does not
+ *     hold its pattern byte, or to if they all do
+ */
+static size_t check_c(const unsigned char *p, size_t from, size_t to,
+		      unsigned char seed, unsigned char step)
+{
+    size_t j;
+
+    for (j = from; j < to; j++)
+	if (p[j] != (unsigned char)(seed + step * j))
+	    break;
+    return j;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+ * pattern - the 64 pattern bytes that start at position j
+ */
+static void pattern(unsigned char *v, size_t j,
+		    unsigned char seed, unsigned char step)
+{
+    int k;
+
+    for (k = 0; k < 64; k++)
+	v[k] = (unsigned char)(seed + step * (j + k));
+}
+
+__attribute__((target("sse2")))
+static void fill_sse2(unsigned char *p, size_t from, size_t to,
+		      unsigned char seed, unsigned char step)
+{
+    unsigned char v[64];
+    __m128i v0, v1, v2, v3, inc;
+    size_t j = from;
+
+    pattern(v, j, seed, step);
+    v0 = _mm_loadu_si128((__m128i *)v);
+    v1 = _mm_loadu_si128((__m128i *)(v + 16));
+    v2 = _mm_loadu_si128((__m128i *)(v + 32));
+    v3 = _mm_loadu_si128((__m128i *)(v + 48));
+    inc = _mm_set1_epi8((char)(64 * step));
+    for (; to - j >= 64; j += 64) {
+	_mm_storeu_si128((__m128i *)(p + j), v0);
+	_mm_storeu_si128((__m128i *)(p + j + 16), v1);
+	_mm_storeu_si128((__m128i *)(p + j + 32), v2);
+	_mm_storeu_si128((__m128i *)(p + j + 48), v3);
+	v0 = _mm_add_epi8(v0, inc);
+	v1 = _mm_add_epi8(v1, inc);
+	v2 = _mm_add_epi8(v2, inc);
+	v3 = _mm_add_epi8(v3, inc);
+    }
+    fill_c(p, j, to, seed, step);
+}
+
+__attribute__((target("sse2")))
+static size_t check_sse2(const unsigned char *p, size_t from, size_t to,
+			 unsigned char seed, unsigned char step)
+{
+    unsigned char v[64];
+    __m128i v0, v1, v2, v3, inc, eq;
+    size_t j = from;
+
+    pattern(v, j, seed, step);
+    v0 = _mm_loadu_si128((__m128i *)v);
+    v1 = _mm_loadu_si128((__m128i *)(v + 16));
+    v2 = _mm_loadu_si128((__m128i *)(v + 32));
+    v3 = _mm_loadu_si128((__m128i *)(v + 48));
+    inc = _mm_set1_epi8((char)(64 * step));
+    for (; to - j >= 64; j += 64) {
+	eq = _mm_and_si128(
+	    _mm_and_si128(
+		_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(p + j)), v0),
+		_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(p + j + 16)), v1)),
+	    _mm_and_si128(
+		_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(p + j + 32)), v2),
+		_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)(p + j + 48)), v3)));
+	if (_mm_movemask_epi8(eq) != 0xFFFF)
+	    break; /* let check_c find the exact byte */
+	v0 = _mm_add_epi8(v0, inc);
+	v1 = _mm_add_epi8(v1, inc);
+	v2 = _mm_add_epi8(v2, inc);
+	v3 = _mm_add_epi8(v3, inc);
+    }
+    return check_c(p, j, to, seed, step);
+}
+
+__attribute__((target("avx2")))
+static void fill_avx2(unsigned char *p, size_t from, size_t to,
+		      unsigned char seed, unsigned char step)
+{
+    unsigned char v[64];
+    __m256i v0, v1, inc;
+    size_t j = from;
+
+    pattern(v, j, seed, step);
+    v0 = _mm256_loadu_si256((__m256i *)v);
+    v1 = _mm256_loadu_si256((__m256i *)(v + 32));
+    inc = _mm256_set1_epi8((char)(64 * step));
+    for (; to - j >= 64; j += 64) {
+	_mm256_storeu_si256((__m256i *)(p + j), v0);
+	_mm256_storeu_si256((__m256i *)(p + j + 32), v1);
+	v0 = _mm256_add_epi8(v0, inc);
+	v1 = _mm256_add_epi8(v1, inc);
+    }
+    fill_c(p, j, to, seed, step);
+}
+
+__attribute__((target("avx2")))
+static size_t check_avx2(const unsigned char *p, size_t from, size_t to,
+			 unsigned char seed, unsigned char step)
+{
+    unsigned char v[64];
+    __m256i v0, v1, inc, eq;
+    size_t j = from;
+
+    pattern(v, j, seed, step);
+    v0 = _mm256_loadu_si256((__m256i *)v);
+    v1 = _mm256_loadu_si256((__m256i *)(v + 32));
+    inc = _mm256_set1_epi8((char)(64 * step));
+    for (; to - j >= 64; j += 64) {
+	eq = _mm256_and_si256(
+	    _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *)(p + j)), v0),
+	    _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *)(p + j + 32)), v1));
+	if (_mm256_movemask_epi8(eq) != -1)
+	    break; /* let check_c find the exact byte */
+	v0 = _mm256_add_epi8(v0, inc);
+	v1 = _mm256_add_epi8(v1, inc);
+    }
+    return check_c(p, j, to, seed, step);
+}
+
+#endif /* x86 */
+
+/*
+ * payload_init - choose the fastest kernels this CPU can run
+ */
+void payload_init(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+	fill = fill_avx2;
+	check = check_avx2;
+	kernel = "AVX2";
+    }
+    else if (__builtin_cpu_supports("sse2")) {
+	fill = fill_sse2;
+	check = check_sse2;
+	kernel = "SSE2";
+    }
+#endif
+}
+
+/*
+ * payload_kernel - name the kernels that payload_init chose
+ */
+const char *payload_kernel(void)
+{
+    return kernel;
+}
+
+/*
+ * payload_fill - write pattern bytes [from, to) of the payload at p
+ */
+void payload_fill(void *p, size_t from, size_t to,
+		  unsigned seed, unsigned step)
+{
+    if (from < to)
+	fill(p, from, to, (unsigned char)seed, (unsigned char)step);
+}
+
+/*
+ * payload_check - return the offset of the first of the n bytes at p
+ *     that does not hold its pattern byte, or n if they all do
+ */
+size_t payload_check(const void *p, size_t n, unsigned seed, unsigned step)
+{
+    return check(p, 0, n, (unsigned char)seed, (unsigned char)step);
+}
@@ -0,0 +1,13 @@
+/*
+ * Fill and check the payloads that mdriver writes into allocated
+ * blocks. Byte j of a payload holds (seed + step*j) mod 256, so a step
+ * of 0 gives the classic repeated byte. An odd step makes the pattern
+ * depend on position, which also catches copies that were shifted.
+ */
+#include <stddef.h>
+
+void payload_init(void);
+const char *payload_kernel(void);
+void payload_fill(void *p, size_t from, size_t to,
+		  unsigned seed, unsigned step);
+size_t payload_check(const void *p, size_t n, unsigned seed, unsigned step);
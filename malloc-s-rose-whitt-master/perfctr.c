@@ -0,0 +1,118 @@
+/*
+ * perfctr.c - Hardware performance counters via perf_event_open
+ *
+ * The counters are opened by perfctr_start and closed by perfctr_stop,
+ * so each measurement belongs to whichever process makes it, including
+ * mdriver's -j workers. Each counter is opened on its own rather than
+ * as a group, so that one missing event does not take the others down
+ * with it. If the kernel has to multiplex them, each count is scaled by
+ * the ratio of the time its counter was enabled to the time it ran.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfctr.h"
+
+#define CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+/* The perf_event type and config of each counter */
+static const struct {
+    char *name;
+    uint32_t type;
+    uint64_t config;
+} events[PC_NUM] = {
+    {"cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"L1d misses",    PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {"LLC misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"dTLB misses",   PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    {"branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+static int fds[PC_NUM];
+static int open_errno = 0;  /* why the last counter that failed to open did */
+
+/*
+ * perfctr_start - open the counters and start counting. Returns the
+ *     number of counters that could be opened.
+ */
+int perfctr_start(void)
+{
+    struct perf_event_attr attr;
+    int i, n = 0;
+
+    for (i = 0; i < PC_NUM; i++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fds[i] < 0)
+	    open_errno = errno;
+	else
+	    n++;
+    }
+
+    /* Start them together, as close to the measured code as we can */
+    for (i = 0; i < PC_NUM; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    return n;
+}
+
+/*
+ * perfctr_stop - stop counting, store the counts in *pc and close the
+ *     counters
+ */
+void perfctr_stop(perfctr_t *pc)
+{
+    uint64_t val[3]; /* count, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PC_NUM; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (i = 0; i < PC_NUM; i++) {
+	pc->valid[i] = 0;
+	pc->counts[i] = 0;
+	if (fds[i] < 0)
+	    continue;
+	if (read(fds[i], val, sizeof(val)) == sizeof(val) && val[2] > 0) {
+	    pc->valid[i] = 1;
+	    pc->counts[i] = (val[2] < val[1]) ?
+		(uint64_t)((double)val[0] * val[1] / val[2]) : val[0];
+	}
+	close(fds[i]);
+    }
+}
+
+/*
+ * perfctr_name - the name of counter i
+ */
+const char *perfctr_name(int i)
+{
+    return events[i].name;
+}
+
+/*
+ * perfctr_error - why the last counter that could not be opened wasn't
+ */
+const char *perfctr_error(void)
+{
+    return strerror(open_errno);
+}
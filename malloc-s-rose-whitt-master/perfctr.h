@@ -0,0 +1,27 @@
+/*
+ * Count hardware events with perf_event_open while code runs. Counting
+ * covers the calling thread and the threads it creates in between
+ * perfctr_start and perfctr_stop, and only their user mode time.
+ * Counters that the CPU, kernel or sandbox cannot provide are left
+ * out, so the caller must check perfctr_t.valid[] for each one.
+ */
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+#include <stdint.h>
+
+/* The events counted */
+enum {PC_CYCLES, PC_INSTRUCTIONS, PC_L1D_MISSES, PC_LLC_MISSES,
+      PC_DTLB_MISSES, PC_BRANCH_MISSES, PC_NUM};
+
+typedef struct {
+    int valid[PC_NUM];        /* was the counter available? */
+    uint64_t counts[PC_NUM];  /* its count, scaled up if it was multiplexed */
+} perfctr_t;
+
+int perfctr_start(void);
+void perfctr_stop(perfctr_t *pc);
+const char *perfctr_name(int i);
+const char *perfctr_error(void);
+
+#endif /* __PERFCTR_H_ */
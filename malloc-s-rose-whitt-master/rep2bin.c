@@ -0,0 +1,30 @@
+/*
+ * rep2bin.c - convert a text .rep trace into the binary trace format
+ *
+ * Usage: rep2bin <in.rep> <out>
+ *
+ * mdriver recognizes binary traces by their header, so the output can be
+ * passed to mdriver -f like any other trace.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+int verbose = 0; /* needed by trace.c */
+
+int main(int argc, char **argv)
+{
+    trace_t *trace;
+
+    if (argc != 3) {
+	fprintf(stderr, "Usage: rep2bin <in.rep> <out>\n");
+	exit(1);
+    }
+    trace = read_trace("", argv[1]);
+    write_trace_bin(trace, argv[2]);
+    printf("%s: %u requests, %u ids\n", argv[2], trace->num_ops,
+	   trace->num_ids);
+    free_trace(trace);
+    exit(0);
+}
@@ -0,0 +1,907 @@
+/*
+ * trace.c - read and write malloc lab trace files
+ *
+ * Text traces (.rep) are parsed into a malloc'ed array of requests by a
+ * hand-written parser that reads the file in large blocks and checks
+ * every request against the header, including the thread annotations of
+ * threaded traces.  Binary traces (see trace.h) are recognized by their
+ * magic number and mapped into memory, so that their requests are used
+ * without copying.
+ *
+ * A streamed trace is decoded by a separate thread into two fixed-size
+ * buffers: while the driver replays the requests in one buffer, the
+ * thread fills the other.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define MAXLINE     1024 /* max string size */
+#define CHUNK_OPS  16384 /* requests per buffer of a streamed trace */
+#define TEXT_BUF (1<<16) /* bytes of a text trace read at a time */
+
+/* A buffered reader for text traces */
+typedef struct {
+    FILE *file;               /* the trace file... */
+    char *path;               /* ... and its name, for error messages */
+    char buf[TEXT_BUF + 1];   /* data read from the file, plus a sentinel */
+    char *pos;                /* next byte to parse */
+    char *lim;                /* end of the complete lines in buf */
+    char *end;                /* end of the data in buf */
+    char limc;                /* the byte at lim, replaced by a NUL */
+    long offset;              /* file offset of buf[0] */
+    int eof;                  /* has the whole file been read? */
+    unsigned long line;       /* line number of pos */
+    size_t bytes;             /* number of bytes read */
+} textin_t;
+
+/* The decoder state of a streamed trace */
+struct trace_stream {
+    FILE *file;               /* the trace file... */
+    char path[MAXLINE];       /* ... its name... */
+    int binary;               /* ... whether it is a binary trace... */
+    long data_offset;         /* ... where its first request starts... */
+    unsigned long data_line;  /* ... and on which line, for text traces */
+    textin_t *text;           /* reader of a text trace */
+    traceop_t *buf[2];        /* the two buffers of decoded requests... */
+    unsigned count[2];        /* ... the number of requests in each... */
+    int full[2];              /* ... and whether each is ready for replay */
+    int fill;                 /* buffer the decoder fills next */
+    int use;                  /* buffer the driver replays next */
+    int holding;              /* is the driver replaying buffer use? */
+    int ended;                /* has the driver reached the end of a pass? */
+    unsigned decoded;         /* requests decoded so far in this pass */
+    int stop;                 /* tells the decoder to quit */
+    int running;              /* is the decoder thread running? */
+    double stall_secs;        /* time the driver spent waiting (trace_stall) */
+    pthread_t thread;
+    pthread_mutex_t lock;     /* protects full, count and stop */
+    pthread_cond_t cond;      /* signaled when any of them changes */
+};
+
+extern int verbose; /* -v option in mdriver.c */
+
+static char msg[2*MAXLINE]; /* room for a path and some text */
+
+static trace_t *new_trace(void);
+static FILE *open_trace(char *path, int *binary);
+static void read_trace_bin(trace_t *trace, char *path);
+static void check_ops_bin(trace_t *trace, traceop_t *ops, unsigned n,
+			  unsigned base, char *path);
+static void read_trace_text(trace_t *trace, char *path);
+static int read_header_text(trace_t *trace, textin_t *in);
+static unsigned read_ops_text(textin_t *in, trace_t *trace, traceop_t *ops,
+			      unsigned n, uint32_t *tids, uint32_t *state);
+static textin_t *text_open(FILE *file, char *path);
+static void text_seek(textin_t *in, long offset, unsigned long line);
+static int text_fill(textin_t *in);
+static int text_skip(textin_t *in);
+static unsigned text_uint(textin_t *in);
+static void text_error(textin_t *in, char *what);
+static void alloc_blocks(trace_t *trace);
+static void *decoder(void *arg);
+static double now(void);
+static void stop_decoder(struct trace_stream *s);
+static void unix_error(char *msg);
+static void app_error(char *msg);
+
+/*
+ * read_trace - read a trace file and store it in memory
+ */
+trace_t *read_trace(char *tracedir, char *filename)
+{
+    trace_t *trace;
+    char path[MAXLINE];
+    int binary;
+
+    if (verbose > 1)
+	printf("Reading tracefile: %s\n", filename);
+
+    /* Allocate the trace record */
+    trace = new_trace();
+	
+    /* Binary traces are mapped, text traces are parsed */
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    fclose(open_trace(path, &binary));
+    if (binary)
+	read_trace_bin(trace, path);
+    else
+	read_trace_text(trace, path);
+
+    alloc_blocks(trace);
+    return trace;
+}
+
+/*
+ * stream_trace - open a trace file for streaming: read only its header
+ *     now and decode its requests as they are visited
+ */
+trace_t *stream_trace(char *tracedir, char *filename)
+{
+    trace_t *trace;
+    struct trace_stream *s;
+    tracehdr_t hdr;
+    int i;
+
+    if (verbose > 1)
+	printf("Streaming tracefile: %s\n", filename);
+
+    trace = new_trace();
+    if ((s = calloc(1, sizeof(struct trace_stream))) == NULL)
+	unix_error("malloc failed in stream_trace");
+    trace->stream = s;
+
+    strcpy(s->path, tracedir);
+    strcat(s->path, filename);
+    s->file = open_trace(s->path, &s->binary);
+    if (s->binary) {
+	if (fread(&hdr, sizeof(hdr), 1, s->file) != 1 ||
+	    hdr.version != TRACE_VERSION || hdr.op_size != sizeof(traceop_t)) {
+	    sprintf(msg, "Bad header in binary tracefile %s", s->path);
+	    app_error(msg);
+	}
+	trace->sugg_heapsize = hdr.sugg_heapsize;
+	trace->num_ids = hdr.num_ids;
+	trace->num_ops = hdr.num_ops;
+	trace->weight = hdr.weight;
+    } else {
+	s->text = text_open(s->file, s->path);
+	if (read_header_text(trace, s->text)) {
+	    sprintf(msg, "Threaded tracefile %s cannot be streamed", s->path);
+	    app_error(msg);
+	}
+	s->data_offset = s->text->offset + (s->text->pos - s->text->buf);
+	s->data_line = s->text->line;
+    }
+    if (s->binary)
+	s->data_offset = ftell(s->file);
+
+    for (i = 0; i < 2; i++)
+	if ((s->buf[i] = malloc(CHUNK_OPS * sizeof(traceop_t))) == NULL)
+	    unix_error("malloc failed in stream_trace");
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+
+    alloc_blocks(trace);
+    return trace;
+}
+
+/*
+ * trace_rewind - start a new pass over the requests of a trace.  Once a
+ *     streamed trace's pass has ended, its decoder has already gone on
+ *     to the next one, so only a pass that was left unfinished (or the
+ *     first one) needs a new decoder.
+ */
+void trace_rewind(trace_t *trace)
+{
+    struct trace_stream *s = trace->stream;
+    double start;
+
+    trace->chunk_done = 0;
+    if (s == NULL)
+	return;
+
+    start = now();
+    if (s->running && s->ended) {
+	/* Drop the empty chunk that ended the last pass */
+	pthread_mutex_lock(&s->lock);
+	s->full[s->use] = 0;
+	s->use ^= 1;
+	s->ended = 0;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	s->stall_secs += now() - start;
+	return;
+    }
+
+    /* Restart the decoder at the first request */
+    stop_decoder(s);
+    if (fseek(s->file, s->data_offset, SEEK_SET) < 0)
+	unix_error("fseek failed in trace_rewind");
+    if (s->text != NULL)
+	text_seek(s->text, s->data_offset, s->data_line);
+    s->full[0] = s->full[1] = 0;
+    s->fill = s->use = 0;
+    s->holding = 0;
+    s->ended = 0;
+    s->decoded = 0;
+    s->stop = 0;
+    if (pthread_create(&s->thread, NULL, decoder, trace) != 0)
+	app_error("pthread_create failed in trace_rewind");
+    s->running = 1;
+    s->stall_secs += now() - start;
+}
+
+/*
+ * trace_next_chunk - point *ops at the next chunk of requests in the
+ *     current pass and return its length.  Returns 0 at the end of the
+ *     trace.  The chunk stays valid until the next call.  An in-memory
+ *     trace is a single chunk.
+ */
+unsigned trace_next_chunk(trace_t *trace, traceop_t **ops)
+{
+    struct trace_stream *s = trace->stream;
+    unsigned n;
+    double start;
+
+    if (s == NULL) {
+	if (trace->chunk_done)
+	    return 0;
+	trace->chunk_done = 1;
+	*ops = trace->ops;
+	return trace->num_ops;
+    }
+
+    start = now();
+    pthread_mutex_lock(&s->lock);
+    if (s->holding) {
+	/* Hand the buffer we are done with back to the decoder */
+	s->full[s->use] = 0;
+	s->use ^= 1;
+	s->holding = 0;
+	pthread_cond_broadcast(&s->cond);
+    }
+    while (!s->full[s->use])
+	pthread_cond_wait(&s->cond, &s->lock);
+    n = s->count[s->use];
+    s->holding = (n > 0);
+    s->ended = (n == 0);
+    pthread_mutex_unlock(&s->lock);
+    s->stall_secs += now() - start;
+
+    *ops = s->buf[s->use];
+    return n;
+}
+
+/*
+ * trace_stall - return the time spent in trace_rewind and
+ *     trace_next_chunk since the last call, waiting for the decoder to
+ *     hand over chunks, and start counting afresh.  An in-memory trace
+ *     never stalls.
+ */
+double trace_stall(trace_t *trace)
+{
+    struct trace_stream *s = trace->stream;
+    double secs;
+
+    if (s == NULL)
+	return 0;
+    secs = s->stall_secs;
+    s->stall_secs = 0;
+    return secs;
+}
+
+/*
+ * now - the current time in seconds, for trace_stall
+ */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/*
+ * decoder - thread that decodes a streamed trace into its two buffers,
+ *     ending each pass with an empty chunk and then going on to decode
+ *     the next pass, so that it is ready when the driver rewinds
+ */
+static void *decoder(void *arg)
+{
+    trace_t *trace = arg;
+    struct trace_stream *s = trace->stream;
+    unsigned n, want;
+
+    for (;;) {
+	pthread_mutex_lock(&s->lock);
+	while (s->full[s->fill] && !s->stop)
+	    pthread_cond_wait(&s->cond, &s->lock);
+	if (s->stop) {
+	    pthread_mutex_unlock(&s->lock);
+	    break;
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	/* Never decode more requests than the header promises */
+	want = trace->num_ops - s->decoded;
+	if (want > CHUNK_OPS)
+	    want = CHUNK_OPS;
+	if (s->binary) {
+	    n = fread(s->buf[s->fill], sizeof(traceop_t), want, s->file);
+	    check_ops_bin(trace, s->buf[s->fill], n, s->decoded, s->path);
+	}
+	else
+	    n = read_ops_text(s->text, trace, s->buf[s->fill], want,
+			      NULL, NULL);
+	if (n < want) {
+	    sprintf(msg, "Tracefile %s holds fewer than %u requests",
+		    s->path, trace->num_ops);
+	    app_error(msg);
+	}
+	if (want == 0 && !s->binary && text_skip(s->text) != EOF) {
+	    sprintf(msg, "Tracefile %s does not hold %u requests",
+		    s->path, trace->num_ops);
+	    app_error(msg);
+	}
+	s->decoded += n;
+
+	pthread_mutex_lock(&s->lock);
+	s->count[s->fill] = n;
+	s->full[s->fill] = 1;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	s->fill ^= 1;
+
+	/* Start over for the next pass */
+	if (n == 0) {
+	    if (fseek(s->file, s->data_offset, SEEK_SET) < 0)
+		unix_error("fseek failed in decoder");
+	    if (s->text != NULL)
+		text_seek(s->text, s->data_offset, s->data_line);
+	    s->decoded = 0;
+	}
+    }
+    return NULL;
+}
+
+/*
+ * stop_decoder - stop a stream's decoder thread, if it is running
+ */
+static void stop_decoder(struct trace_stream *s)
+{
+    if (!s->running)
+	return;
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+    s->running = 0;
+}
+
+/*
+ * new_trace - allocate an empty trace record
+ */
+static trace_t *new_trace(void)
+{
+    trace_t *trace;
+
+    if ((trace = (trace_t *) calloc(1, sizeof(trace_t))) == NULL)
+	unix_error("malloc 1 failed in read_trance");
+    trace->num_threads = 1;
+    trace->first_line = 5; /* as in the text trace a binary one came from */
+    return trace;
+}
+
+/*
+ * open_trace - open a trace file and look at its first bytes to tell
+ *     binary from text traces.  Returns the file positioned at its start.
+ */
+static FILE *open_trace(char *path, int *binary)
+{
+    FILE *tracefile;
+    char magic[sizeof(TRACE_MAGIC)];
+
+    if ((tracefile = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in read_trace", path);
+	unix_error(msg);
+    }
+    *binary = (fread(magic, 1, sizeof(magic), tracefile) == sizeof(magic) &&
+	       memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0);
+    rewind(tracefile);
+    return tracefile;
+}
+
+/*
+ * alloc_blocks - allocate the arrays that record the blocks of a trace
+ */
+static void alloc_blocks(trace_t *trace)
+{
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_trace");
+}
+
+/*
+ * read_trace_bin - map a binary trace file and point the trace's request
+ *     array into the mapping
+ */
+static void read_trace_bin(trace_t *trace, char *path)
+{
+    int fd;
+    struct stat st;
+    tracehdr_t *hdr;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+	sprintf(msg, "Could not open %s in read_trace", path);
+	unix_error(msg);
+    }
+    if ((size_t)st.st_size < sizeof(tracehdr_t)) {
+	sprintf(msg, "Truncated binary tracefile %s", path);
+	app_error(msg);
+    }
+    trace->map_len = st.st_size;
+    trace->map = mmap(NULL, trace->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (trace->map == MAP_FAILED) {
+	sprintf(msg, "Could not map %s in read_trace", path);
+	unix_error(msg);
+    }
+    close(fd);
+
+    hdr = trace->map;
+    if (hdr->version != TRACE_VERSION || hdr->op_size != sizeof(traceop_t)) {
+	sprintf(msg, "Unsupported version or byte order in tracefile %s",
+		path);
+	app_error(msg);
+    }
+    if (trace->map_len != sizeof(tracehdr_t) +
+	(size_t)hdr->num_ops * sizeof(traceop_t)) {
+	sprintf(msg, "Binary tracefile %s does not hold %u requests",
+		path, hdr->num_ops);
+	app_error(msg);
+    }
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    trace->ops = (traceop_t *)(hdr + 1);
+    check_ops_bin(trace, trace->ops, trace->num_ops, 0, path);
+}
+
+/*
+ * check_ops_bin - check the n requests of a binary trace at ops, the
+ *     first of which is request number base, as read_ops_text checks
+ *     those of a text trace: each must be of a known type, name an id
+ *     below num_ids, and ask for at most INT_MAX bytes
+ */
+static void check_ops_bin(trace_t *trace, traceop_t *ops, unsigned n,
+			  unsigned base, char *path)
+{
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+	if ((ops[i].type != ALLOC && ops[i].type != FREE &&
+	     ops[i].type != REALLOC) ||
+	    ops[i].index >= trace->num_ids ||
+	    (ops[i].type != FREE && ops[i].size > INT_MAX)) {
+	    sprintf(msg, "Bad request %u in binary tracefile %s",
+		    base + i, path);
+	    app_error(msg);
+	}
+}
+
+/*
+ * read_trace_text - parse a text trace file into a malloc'ed request array
+ */
+static void read_trace_text(trace_t *trace, char *path)
+{
+    FILE *tracefile;
+    textin_t *in;
+    uint32_t *state = NULL;
+    int threaded;
+    struct timespec start, stop;
+    double secs;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* Read the trace file header */
+    if ((tracefile = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in read_trace", path);
+	unix_error(msg);
+    }
+    in = text_open(tracefile, path);
+    threaded = read_header_text(trace, in);
+    
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops = 
+	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	unix_error("malloc 2 failed in read_trace");
+
+    /* ... along with the thread of each request in a threaded trace */
+    if (threaded) {
+	if ((trace->tids = malloc(trace->num_ops * sizeof(uint32_t))) == NULL ||
+	    (state = calloc(trace->num_ids, sizeof(uint32_t))) == NULL)
+	    unix_error("malloc 2 failed in read_trace");
+    }
+
+    /* read every request line in the trace file, and nothing more */
+    if (read_ops_text(in, trace, trace->ops, trace->num_ops, trace->tids,
+		      state) != trace->num_ops || text_skip(in) != EOF) {
+	sprintf(msg, "Tracefile %s does not hold %u requests",
+		path, trace->num_ops);
+	app_error(msg);
+    }
+    fclose(tracefile);
+    free(state);
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    secs = (stop.tv_sec - start.tv_sec) + 1e-9 * (stop.tv_nsec - start.tv_nsec);
+    if (verbose)
+	printf("Parsed %u requests (%.1f MB) in %.6f secs: "
+	       "%.1f Mreqs/sec, %.1f MB/sec\n",
+	       trace->num_ops, in->bytes / 1e6, secs,
+	       trace->num_ops / 1e6 / secs, in->bytes / 1e6 / secs);
+    free(in);
+}
+
+/*
+ * read_header_text - read the header lines of a text trace file.  The
+ *     requests of a plain trace start with a letter, so a number after
+ *     the fourth line is the thread count of a threaded trace.  Leaves in
+ *     at the first request, whose line it records, and returns whether
+ *     the trace is threaded.
+ */
+static int read_header_text(trace_t *trace, textin_t *in)
+{
+    int threaded = 0;
+
+    text_skip(in);
+    trace->sugg_heapsize = text_uint(in); /* not used */
+    text_skip(in);
+    trace->num_ids = text_uint(in);     
+    text_skip(in);
+    trace->num_ops = text_uint(in);     
+    text_skip(in);
+    trace->weight = text_uint(in);        /* not used */
+    if ((unsigned)(text_skip(in) - '0') <= 9) {
+	if ((trace->num_threads = text_uint(in)) == 0)
+	    text_error(in, "A threaded trace needs at least one thread");
+	threaded = 1;
+    }
+    text_skip(in);
+    trace->first_line = in->line;
+    return threaded;
+}
+
+/* States of an id while a threaded trace is read (or owner's tid + 1) */
+#define UNUSED 0               /* not allocated yet */
+#define FREED  UINT32_MAX      /* allocated and freed */
+
+/*
+ * read_ops_text - parse up to n request lines from a text trace file into
+ *     ops.  Returns the number of requests read, which is less than n only
+ *     at the end of the file.  Every id must be less than num_ids.  For a
+ *     threaded trace, the thread of each request goes in tids, and state
+ *     tracks which thread owns each id, so that misplaced frees and
+ *     reallocs are caught here.
+ */
+static unsigned read_ops_text(textin_t *in, trace_t *trace, traceop_t *ops,
+			      unsigned n, uint32_t *tids, uint32_t *state)
+{
+    unsigned i, id, tid = 0;
+    int c;
+    char *p;
+
+    for (i = 0; i < n; i++) {
+	if ((c = text_skip(in)) == EOF)
+	    break;
+	if (tids != NULL) {
+	    if ((tid = tids[i] = text_uint(in)) >= trace->num_threads)
+		text_error(in, "Thread out of range");
+	    while (*in->pos == ' ' || *in->pos == '\t')
+		in->pos++;
+	    c = (unsigned char)*in->pos;
+	}
+	in->pos++;
+	switch (c) {
+	case 'a':
+	    ops[i].type = ALLOC;
+	    break;
+	case 'r':
+	    ops[i].type = REALLOC;
+	    break;
+	case 'f':
+	    ops[i].type = FREE;
+	    break;
+	case 'F':
+	    if (tids != NULL) {
+		ops[i].type = FREE;
+		break;
+	    }
+	    /* fall through */
+	default:
+	    sprintf(msg, "Bogus type character (%c)", c);
+	    text_error(in, msg);
+	}
+	if ((id = ops[i].index = text_uint(in)) >= trace->num_ids)
+	    text_error(in, "Id out of range");
+
+	/* Only a block's owner may realloc it or free it with "f" */
+	if (state != NULL) {
+	    if (c == 'a' && state[id] != UNUSED)
+		text_error(in, "Id allocated twice in a threaded trace");
+	    if ((c == 'r' || c == 'f') && state[id] != tid + 1)
+		text_error(in, "Block is not allocated by this thread");
+	    if (c == 'F' && (state[id] == UNUSED || state[id] == FREED ||
+			     state[id] == tid + 1))
+		text_error(in, "Block is not allocated by another thread");
+	    state[id] = (c == 'f' || c == 'F') ? FREED : tid + 1;
+	}
+
+	if (c == 'f' || c == 'F')
+	    ops[i].size = 0;
+	else if ((ops[i].size = text_uint(in)) > INT_MAX)
+	    text_error(in, "Size out of range");
+
+	/* Nothing else may follow on the line */
+	for (p = in->pos; *p == ' ' || *p == '\t' || *p == '\r'; p++)
+	    ;
+	if (*p != '\n' && *p != '\0')
+	    text_error(in, "Junk after request");
+	in->pos = p;
+    }
+    return i;
+}
+
+/*
+ * text_open - start reading a text trace file from its beginning
+ */
+static textin_t *text_open(FILE *file, char *path)
+{
+    textin_t *in;
+
+    if ((in = malloc(sizeof(textin_t))) == NULL)
+	unix_error("malloc failed in text_open");
+    in->file = file;
+    in->path = path;
+    in->bytes = 0;
+    text_seek(in, 0, 1);
+    return in;
+}
+
+/*
+ * text_seek - forget any buffered data: the file is now positioned at
+ *     offset, which is the start of the given line
+ */
+static void text_seek(textin_t *in, long offset, unsigned long line)
+{
+    in->pos = in->lim = in->end = in->buf;
+    in->limc = '\0';
+    *in->lim = '\0';
+    in->offset = offset;
+    in->eof = 0;
+    in->line = line;
+}
+
+/*
+ * text_fill - read the next block of the file once every complete line in
+ *     the buffer has been parsed.  Only complete lines are made available,
+ *     and they are followed by a NUL, so the parser never has to check
+ *     for the end of the buffer in the middle of a request.  Returns 0 at
+ *     the end of the file.
+ */
+static int text_fill(textin_t *in)
+{
+    size_t tail, n;
+    char *nl;
+
+    if (in->eof)
+	return 0;
+
+    /* Keep the partial line at the end of the buffer */
+    *in->lim = in->limc;
+    tail = in->end - in->lim;
+    memmove(in->buf, in->lim, tail);
+    in->offset += in->lim - in->buf;
+
+    n = fread(in->buf + tail, 1, TEXT_BUF - tail, in->file);
+    if (n < TEXT_BUF - tail) {
+	if (ferror(in->file)) {
+	    sprintf(msg, "Could not read %s", in->path);
+	    unix_error(msg);
+	}
+	in->eof = 1;
+    }
+    in->bytes += n;
+    in->pos = in->buf;
+    in->end = in->buf + tail + n;
+
+    /* Stop after the last newline, unless this is the end of the file */
+    if (in->eof)
+	in->lim = in->end;
+    else {
+	for (nl = in->end; nl > in->buf && nl[-1] != '\n'; nl--)
+	    ;
+	if (nl == in->buf)
+	    text_error(in, "Line too long");
+	in->lim = nl;
+    }
+    in->limc = *in->lim;
+    *in->lim = '\0';
+    return 1;
+}
+
+/*
+ * text_skip - skip white space, reading more of the file as needed.
+ *     Returns the next character, or EOF at the end of the file.
+ */
+static int text_skip(textin_t *in)
+{
+    char *p = in->pos;
+
+    for (;;) {
+	for (; *p == ' ' || *p == '\n' || *p == '\t' || *p == '\r'; p++)
+	    in->line += (*p == '\n');
+	if (*p != '\0' || p < in->lim) {
+	    in->pos = p;
+	    return (unsigned char)*p;
+	}
+	in->pos = p;
+	if (!text_fill(in))
+	    return EOF;
+	p = in->pos;
+    }
+}
+
+/*
+ * text_uint - parse an unsigned 32-bit number on the current line
+ */
+static unsigned text_uint(textin_t *in)
+{
+    char *p = in->pos;
+    uint64_t v = 0;
+    unsigned d;
+
+    while (*p == ' ' || *p == '\t')
+	p++;
+    if ((d = (unsigned)(*p - '0')) > 9)
+	text_error(in, "Expected a number");
+    do {
+	v = v * 10 + d;
+	if (v > UINT32_MAX)
+	    text_error(in, "Number out of range");
+	d = (unsigned)(*++p - '0');
+    } while (d <= 9);
+    in->pos = p;
+    return (unsigned)v;
+}
+
+/*
+ * text_error - report a syntax error at the current line of a text trace
+ */
+static void text_error(textin_t *in, char *what)
+{
+    printf("%s:%lu: %s\n", in->path, in->line, what);
+    exit(1);
+}
+
+/*
+ * write_trace_bin - write a trace to path in the binary trace format
+ */
+void write_trace_bin(trace_t *trace, char *path)
+{
+    FILE *out;
+    tracehdr_t hdr;
+    traceop_t *ops;
+    unsigned n;
+
+    if (trace->tids != NULL)
+	app_error("Threaded traces cannot be written in the binary format");
+
+    memset(&hdr, 0, sizeof(hdr));
+    strcpy(hdr.magic, TRACE_MAGIC);
+    hdr.version = TRACE_VERSION;
+    hdr.op_size = sizeof(traceop_t);
+    hdr.sugg_heapsize = trace->sugg_heapsize;
+    hdr.num_ids = trace->num_ids;
+    hdr.num_ops = trace->num_ops;
+    hdr.weight = trace->weight;
+
+    if ((out = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s in write_trace_bin", path);
+	unix_error(msg);
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+	goto write_error;
+    trace_rewind(trace);
+    while ((n = trace_next_chunk(trace, &ops)) > 0)
+	if (fwrite(ops, sizeof(traceop_t), n, out) != n)
+	    goto write_error;
+    if (fclose(out) == 0)
+	return;
+
+ write_error:
+    sprintf(msg, "Could not write %s in write_trace_bin", path);
+    unix_error(msg);
+}
+
+/*
+ * trace_pack - pre-decode the requests of an in-memory trace into
+ *     trace->packed and trace->packed_sizes.  Returns 0 on success, and
+ *     -1 if the trace is streamed or has too many ids to pack.
+ */
+int trace_pack(trace_t *trace)
+{
+    traceop_t *ops;
+    uint32_t *op, *size;
+    unsigned i, n;
+
+    if (trace->stream != NULL || trace->num_ids > PACK_ID_MASK + 1)
+	return -1;
+    if (trace->packed != NULL)
+	return 0;
+    if ((trace->packed = malloc((trace->num_ops + 1) * sizeof(uint32_t)))
+	== NULL ||
+	(trace->packed_sizes = malloc((trace->num_ops + 1) * sizeof(uint32_t)))
+	== NULL)
+	unix_error("malloc failed in trace_pack");
+
+    op = trace->packed;
+    size = trace->packed_sizes;
+    trace_rewind(trace);
+    while ((n = trace_next_chunk(trace, &ops)) > 0)
+	for (i = 0; i < n; i++) {
+	    *op++ = ops[i].type << PACK_TYPE_SHIFT | ops[i].index;
+	    if (ops[i].type != FREE)
+		*size++ = ops[i].size;
+	}
+    *op = PACK_END;
+    return 0;
+}
+
+/*
+ * free_trace - Free the trace record and the three arrays it points
+ *              to, all of which were allocated (or mapped) in read_trace().
+ */
+void free_trace(trace_t *trace)
+{
+    struct trace_stream *s = trace->stream;
+
+    if (s != NULL) {          /* stop decoding a streamed trace... */
+	stop_decoder(s);
+	fclose(s->file);
+	free(s->text);
+	free(s->buf[0]);
+	free(s->buf[1]);
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->cond);
+	free(s);
+    }
+    else if (trace->map != NULL) /* ... or unmap a binary trace... */
+	munmap(trace->map, trace->map_len);
+    else
+	free(trace->ops);     /* ... or free the three arrays... */
+    free(trace->tids);
+    free(trace->blocks);      
+    free(trace->block_sizes);
+    free(trace->packed);
+    free(trace->packed_sizes);
+    free(trace);              /* and the trace record itself... */
+}
+
+/* 
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg) 
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/* 
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg) 
+{
+    printf("%s\n", msg);
+    exit(1);
+}
@@ -0,0 +1,97 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+/*
+ * trace.h - reading and writing malloc lab trace files
+ *
+ * A trace is either a text .rep file or a binary trace.  A binary trace
+ * is a tracehdr_t followed by num_ops traceop_t records, stored in host
+ * byte order, so that it can be mapped and used in place.
+ *
+ * read_trace loads all of a trace's requests into memory.  stream_trace
+ * instead decodes them a chunk at a time while they are replayed, so the
+ * size of a trace is not limited by the driver's memory.  Either way, the
+ * requests are visited with trace_rewind and trace_next_chunk, and
+ * trace_stall tells how long the driver has waited for a streamed
+ * trace's decoder.
+ *
+ * A threaded text trace has a fifth header line, the number of threads,
+ * and every request starts with the id of the thread that made it:
+ *
+ *     <tid> a <id> <size>     <tid> r <id> <size>     <tid> f <id>
+ *
+ * An id names one allocation and is never reused, and only the thread
+ * that allocated a block may realloc it.  A block freed by any other
+ * thread is freed with "F" instead of "f": a threaded replay must wait
+ * until the allocating thread has published the block before it frees
+ * it.  Threaded traces are only read into memory, never streamed or
+ * written in the binary format.
+ *
+ * trace_pack also pre-decodes an in-memory trace for the fastest replay,
+ * into two arrays.  packed holds one word per request, with the request
+ * type in its top two bits and the id below them, and ends with a
+ * PACK_END word.  packed_sizes holds the sizes of the allocs and reallocs
+ * alone, in trace order, so that a replay reads both arrays straight
+ * through.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+/* Request types */
+enum {ALLOC, FREE, REALLOC};
+
+/* Fields of a packed request (see trace_pack) */
+#define PACK_TYPE_SHIFT 30
+#define PACK_ID_MASK ((1u << PACK_TYPE_SHIFT) - 1)
+#define PACK_END (3u << PACK_TYPE_SHIFT)
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    uint32_t type;                    /* type of request */
+    uint32_t index;                   /* index for free() to use later */
+    uint32_t size;                    /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* Holds the information for one trace file*/
+typedef struct {
+    unsigned sugg_heapsize;   /* suggested heap size (unused) */
+    unsigned num_ids;         /* number of alloc/realloc ids */
+    unsigned num_ops;         /* number of distinct requests */
+    unsigned weight;          /* weight for this trace (unused) */
+    unsigned num_threads;     /* number of threads that made the requests */
+    unsigned first_line;      /* line of the first request (origin 1) */
+    traceop_t *ops;      /* array of requests */
+    uint32_t *tids;      /* thread of each request (NULL if not threaded) */
+    char **blocks;       /* array of ptrs returned by malloc/realloc... */
+    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* mapping of a binary trace file (or NULL)... */
+    size_t map_len;      /* ... and its length in bytes */
+    struct trace_stream *stream; /* decoder of a streamed trace (or NULL) */
+    int chunk_done;      /* has an in-memory trace's one chunk been visited? */
+    uint32_t *packed;    /* pre-decoded requests (or NULL)... */
+    uint32_t *packed_sizes; /* ... and their sizes (see trace_pack) */
+} trace_t;
+
+/* The header of a binary trace file */
+#define TRACE_MAGIC "MMTRACE"
+#define TRACE_VERSION 1
+typedef struct {
+    char magic[8];            /* TRACE_MAGIC, NUL-terminated */
+    uint32_t version;         /* TRACE_VERSION */
+    uint32_t op_size;         /* sizeof(traceop_t); also detects byte order */
+    uint32_t sugg_heapsize;
+    uint32_t num_ids;
+    uint32_t num_ops;
+    uint32_t weight;
+} tracehdr_t;
+
+trace_t *read_trace(char *tracedir, char *filename);
+trace_t *stream_trace(char *tracedir, char *filename);
+void trace_rewind(trace_t *trace);
+unsigned trace_next_chunk(trace_t *trace, traceop_t **ops);
+double trace_stall(trace_t *trace);
+void write_trace_bin(trace_t *trace, char *path);
+int trace_pack(trace_t *trace);
+void free_trace(trace_t *trace);
+
+#endif /* __TRACE_H_ */
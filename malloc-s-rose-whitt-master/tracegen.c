@@ -0,0 +1,520 @@
+/*
+ * tracegen.c - generate synthetic malloc lab traces
+ *
+ * Usage: tracegen [-b] [-s <seed>] <params> <out>
+ *
+ * Writes a .rep trace to out, or a binary trace with -b. The requests
+ * are drawn from the distributions in the parameter file with a seeded
+ * generator, so a parameter file and a seed always give the same trace.
+ * That makes it easy to build a corpus of large or oddly shaped traces
+ * for tuning the size classes of the segregated free lists
+ * (find_list_head in mm.c).
+ *
+ * The parameter file has one setting per line, and '#' starts a comment:
+ *
+ *     seed <n>                       seed of the generator (-s overrides)
+ *     ops <n>                        number of requests to generate
+ *     size fixed <n>                 size of each new block ...
+ *     size uniform <lo> <hi>
+ *     size pareto <min> <alpha> <max>   ... power law, truncated at max
+ *     life fixed <n>                 lifetime of each new block ...
+ *     life exp <mean>
+ *     life bimodal <p> <mean1> <mean2>  ... exp(mean1) with probability p,
+ *                                        otherwise exp(mean2)
+ *     chain <p> <steps> <factor>     with probability p, a new block is
+ *                                    realloc'd steps times during its
+ *                                    life, growing by factor each time
+ *     phase <weight>                 start a new phase
+ *
+ * A lifetime counts the allocations made while the block is live. The
+ * size, life and chain settings before the first phase line are the
+ * defaults; each phase starts from the settings of the one before it.
+ * Phases split the requests in proportion to their weights. When the
+ * requests run out, the blocks that are still live are freed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "trace.h"
+
+#define MAXLINE   1024  /* max length of a parameter file line */
+#define MAXPHASES 64    /* max number of phases */
+#define MAXSIZE   (1u << 30) /* no block grows larger than this */
+
+int verbose = 0; /* needed by trace.c */
+
+/* Distributions of block sizes and lifetimes */
+enum {FIXED, UNIFORM, PARETO, EXP, BIMODAL};
+
+typedef struct {
+    int kind;
+    double a, b, c;             /* parameters, in the order they are given */
+} dist_t;
+
+/* The settings of one phase */
+typedef struct {
+    double weight;
+    dist_t size;
+    dist_t life;
+    double chain_p;             /* probability that a block is realloc'd... */
+    unsigned chain_steps;       /* ... this many times... */
+    double chain_factor;        /* ... growing by this factor each time */
+} phase_t;
+
+/* A request waiting for its time to come */
+typedef struct {
+    uint64_t time;
+    uint64_t seq;               /* breaks ties in the order of scheduling */
+    traceop_t op;
+} event_t;
+
+/* The events, kept as a binary min-heap on (time, seq) */
+typedef struct {
+    event_t *ev;
+    size_t n, max;
+} heap_t;
+
+static uint64_t seed = 1;
+static unsigned num_requests = 10000;
+static phase_t phases[MAXPHASES];
+static int num_phases = 0;
+
+static void read_params(char *path);
+static void read_dist(dist_t *d, char *what, char *path, int line);
+static void generate(trace_t *trace);
+static void write_trace_text(trace_t *trace, char *path);
+static uint64_t next_rand(void);
+static double uniform(void);
+static unsigned draw(dist_t *d);
+static void heap_push(heap_t *h, uint64_t time, uint64_t seq, traceop_t *op);
+static void heap_pop(heap_t *h, event_t *e);
+static int before(event_t *x, event_t *y);
+static void usage(void);
+static void unix_error(char *msg);
+static void app_error(char *msg);
+
+int main(int argc, char **argv)
+{
+    trace_t *trace;
+    int c, binary = 0, have_seed = 0;
+    uint64_t seed_opt = 0;
+
+    while ((c = getopt(argc, argv, "bs:h")) != EOF) {
+	switch (c) {
+	case 'b':
+	    binary = 1;
+	    break;
+	case 's':
+	    seed_opt = strtoull(optarg, NULL, 0);
+	    have_seed = 1;
+	    break;
+	case 'h':
+	default:
+	    usage();
+	}
+    }
+    if (argc - optind != 2)
+	usage();
+
+    read_params(argv[optind]);
+    if (have_seed)
+	seed = seed_opt;
+
+    if ((trace = calloc(1, sizeof(trace_t))) == NULL)
+	unix_error("calloc failed in main");
+    trace->weight = 1;
+    trace->num_threads = 1;
+    generate(trace);
+
+    if (binary)
+	write_trace_bin(trace, argv[optind + 1]);
+    else
+	write_trace_text(trace, argv[optind + 1]);
+    printf("%s: %u requests, %u ids, peak live %u bytes\n",
+	   argv[optind + 1], trace->num_ops, trace->num_ids,
+	   trace->sugg_heapsize);
+    free_trace(trace);
+    exit(0);
+}
+
+/*
+ * read_params - read the parameter file at path into the globals
+ */
+static void read_params(char *path)
+{
+    FILE *file;
+    char line[MAXLINE], msg[MAXLINE + 64];
+    char *key, *arg;
+    phase_t defaults, *cur = &defaults;
+    int lineno = 0;
+
+    /* Defaults: the kind of mix the lab traces have */
+    memset(&defaults, 0, sizeof(defaults));
+    defaults.weight = 1;
+    defaults.size.kind = UNIFORM;
+    defaults.size.a = 1;
+    defaults.size.b = 4096;
+    defaults.life.kind = EXP;
+    defaults.life.a = 100;
+    defaults.chain_factor = 2;
+
+    if ((file = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in read_params", path);
+	unix_error(msg);
+    }
+    while (fgets(line, MAXLINE, file) != NULL) {
+	lineno++;
+	line[strcspn(line, "#\n")] = '\0';
+	if ((key = strtok(line, " \t\r")) == NULL)
+	    continue;
+	arg = strtok(NULL, " \t\r");
+
+	if (!strcmp(key, "seed") && arg != NULL)
+	    seed = strtoull(arg, NULL, 0);
+	else if (!strcmp(key, "ops") && arg != NULL)
+	    num_requests = strtoul(arg, NULL, 0);
+	else if (!strcmp(key, "size") && arg != NULL)
+	    read_dist(&cur->size, arg, path, lineno);
+	else if (!strcmp(key, "life") && arg != NULL)
+	    read_dist(&cur->life, arg, path, lineno);
+	else if (!strcmp(key, "chain") && arg != NULL) {
+	    char *steps = strtok(NULL, " \t\r");
+	    char *factor = strtok(NULL, " \t\r");
+
+	    if (steps == NULL || factor == NULL)
+		goto bad_line;
+	    cur->chain_p = atof(arg);
+	    cur->chain_steps = strtoul(steps, NULL, 0);
+	    cur->chain_factor = atof(factor);
+	    if (cur->chain_factor < 1)
+		goto bad_line;
+	}
+	else if (!strcmp(key, "phase") && arg != NULL) {
+	    if (num_phases == MAXPHASES)
+		app_error("Too many phases in the parameter file");
+	    /* Later settings apply to the new phase */
+	    phases[num_phases] = *cur;
+	    cur = &phases[num_phases++];
+	    if ((cur->weight = atof(arg)) <= 0)
+		goto bad_line;
+	}
+	else
+	    goto bad_line;
+    }
+    fclose(file);
+
+    if (num_phases == 0)
+	phases[num_phases++] = defaults;
+    return;
+
+ bad_line:
+    sprintf(msg, "%s:%d: bad parameter line", path, lineno);
+    app_error(msg);
+}
+
+/*
+ * read_dist - parse the distribution named by what, whose parameters
+ *     are the remaining tokens of the current line
+ */
+static void read_dist(dist_t *d, char *what, char *path, int line)
+{
+    static const struct { char *name; int kind; int nargs; } kinds[] = {
+	{"fixed", FIXED, 1}, {"uniform", UNIFORM, 2}, {"pareto", PARETO, 3},
+	{"exp", EXP, 1}, {"bimodal", BIMODAL, 3},
+    };
+    double args[3] = {0, 0, 0};
+    char msg[MAXLINE + 64], *tok;
+    unsigned i;
+    int j;
+
+    for (i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++)
+	if (!strcmp(what, kinds[i].name))
+	    break;
+    if (i == sizeof(kinds) / sizeof(kinds[0]))
+	goto bad_dist;
+    for (j = 0; j < kinds[i].nargs; j++) {
+	if ((tok = strtok(NULL, " \t\r")) == NULL)
+	    goto bad_dist;
+	args[j] = atof(tok);
+    }
+
+    /* Reject parameters that cannot give positive integers */
+    switch (kinds[i].kind) {
+    case FIXED:
+    case EXP:
+	if (args[0] < 1)
+	    goto bad_dist;
+	break;
+    case UNIFORM:
+	if (args[0] < 1 || args[1] < args[0])
+	    goto bad_dist;
+	break;
+    case PARETO:
+	if (args[0] < 1 || args[1] <= 0 || args[2] < args[0])
+	    goto bad_dist;
+	break;
+    case BIMODAL:
+	if (args[0] < 0 || args[0] > 1 || args[1] < 1 || args[2] < 1)
+	    goto bad_dist;
+	break;
+    }
+    d->kind = kinds[i].kind;
+    d->a = args[0];
+    d->b = args[1];
+    d->c = args[2];
+    return;
+
+ bad_dist:
+    sprintf(msg, "%s:%d: bad distribution", path, line);
+    app_error(msg);
+}
+
+/*
+ * generate - fill in the requests of trace. New blocks are allocated
+ *     one per tick of the clock; before each one, every realloc or free
+ *     whose time has come is issued.
+ */
+static void generate(trace_t *trace)
+{
+    heap_t heap = {NULL, 0, 0};
+    event_t e;
+    traceop_t op;
+    uint32_t *sizes = NULL;
+    size_t max_ops = 0, max_ids = 0;
+    uint64_t clock = 0, seq = 0, live = 0, peak = 0;
+    double total = 0, end;
+    phase_t *p;
+    unsigned life, steps, size, k;
+    int ph = 0;
+
+    for (k = 0; k < (unsigned)num_phases; k++)
+	total += phases[k].weight;
+    end = num_requests * phases[0].weight / total;
+
+    for (;;) {
+	/* Issue the requests that are due, or all of them at the end */
+	while (heap.n > 0 &&
+	       (heap.ev[0].time <= clock ||
+		trace->num_ops + heap.n >= num_requests)) {
+	    heap_pop(&heap, &e);
+	    if (trace->num_ops == max_ops) {
+		max_ops = max_ops ? 2 * max_ops : 4096;
+		trace->ops = realloc(trace->ops, max_ops * sizeof(traceop_t));
+		if (trace->ops == NULL)
+		    unix_error("realloc failed in generate");
+	    }
+	    trace->ops[trace->num_ops++] = e.op;
+	    live -= sizes[e.op.index];
+	    sizes[e.op.index] = e.op.size;
+	    live += e.op.size;
+	    if (live > peak)
+		peak = live;
+	}
+	if (trace->num_ops + heap.n >= num_requests)
+	    break;
+
+	while (ph < num_phases - 1 && trace->num_ops + heap.n >= end)
+	    end += num_requests * phases[++ph].weight / total;
+	p = &phases[ph];
+
+	/* Allocate a new block, and schedule its reallocs and its free */
+	if (trace->num_ids == max_ids) {
+	    max_ids = max_ids ? 2 * max_ids : 4096;
+	    if ((sizes = realloc(sizes, max_ids * sizeof(uint32_t))) == NULL)
+		unix_error("realloc failed in generate");
+	}
+	op.index = trace->num_ids++;
+	op.size = size = draw(&p->size);
+	steps = (uniform() < p->chain_p) ? p->chain_steps : 0;
+	life = draw(&p->life);
+	if (life < steps + 1)
+	    life = steps + 1;
+
+	op.type = ALLOC;
+	heap_push(&heap, clock, seq++, &op);
+	op.type = REALLOC;
+	for (k = 1; k <= steps; k++) {
+	    size = (size * p->chain_factor < MAXSIZE) ?
+		(unsigned)ceil(size * p->chain_factor) : MAXSIZE;
+	    op.size = size;
+	    heap_push(&heap, clock + (uint64_t)life * k / (steps + 1),
+		      seq++, &op);
+	}
+	op.type = FREE;
+	op.size = 0;
+	heap_push(&heap, clock + life, seq++, &op);
+
+	sizes[op.index] = 0;
+	clock++;
+    }
+
+    trace->sugg_heapsize = peak < UINT32_MAX ? (unsigned)peak : UINT32_MAX;
+    free(sizes);
+    free(heap.ev);
+}
+
+/*
+ * write_trace_text - write a trace to path as a .rep file
+ */
+static void write_trace_text(trace_t *trace, char *path)
+{
+    FILE *out;
+    traceop_t *op;
+    char msg[MAXLINE + 64];
+    unsigned i;
+
+    if ((out = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s in write_trace_text", path);
+	unix_error(msg);
+    }
+    fprintf(out, "%u\n%u\n%u\n%u\n", trace->sugg_heapsize, trace->num_ids,
+	    trace->num_ops, trace->weight);
+    for (i = 0; i < trace->num_ops; i++) {
+	op = &trace->ops[i];
+	if (op->type == FREE)
+	    fprintf(out, "f %u\n", op->index);
+	else
+	    fprintf(out, "%c %u %u\n", op->type == ALLOC ? 'a' : 'r',
+		    op->index, op->size);
+    }
+    if (fclose(out) != 0) {
+	sprintf(msg, "Could not write %s in write_trace_text", path);
+	unix_error(msg);
+    }
+}
+
+/*
+ * next_rand - splitmix64, which gives the same stream on every host
+ */
+static uint64_t next_rand(void)
+{
+    uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/*
+ * uniform - a random double in [0, 1)
+ */
+static double uniform(void)
+{
+    return (next_rand() >> 11) * 0x1.0p-53;
+}
+
+/*
+ * draw - a random positive integer from distribution d
+ */
+static unsigned draw(dist_t *d)
+{
+    double x = 0, u = uniform();
+    double r;
+
+    switch (d->kind) {
+    case FIXED:
+	x = d->a;
+	break;
+    case UNIFORM:
+	x = d->a + floor(u * (d->b - d->a + 1));
+	break;
+    case PARETO:
+	/* Invert the CDF of a Pareto distribution truncated at c */
+	r = 1 - u * (1 - pow(d->a / d->c, d->b));
+	x = floor(d->a / pow(r, 1 / d->b));
+	break;
+    case EXP:
+	x = 1 + floor(-d->a * log(1 - u));
+	break;
+    case BIMODAL:
+	r = (u < d->a) ? d->b : d->c;
+	x = 1 + floor(-r * log(1 - uniform()));
+	break;
+    }
+    if (x < 1)
+	return 1;
+    return x < MAXSIZE ? (unsigned)x : MAXSIZE;
+}
+
+/*
+ * heap_push - schedule op at time
+ */
+static void heap_push(heap_t *h, uint64_t time, uint64_t seq, traceop_t *op)
+{
+    size_t i, parent;
+    event_t e = {time, seq, *op};
+
+    if (h->n == h->max) {
+	h->max = h->max ? 2 * h->max : 4096;
+	if ((h->ev = realloc(h->ev, h->max * sizeof(event_t))) == NULL)
+	    unix_error("realloc failed in heap_push");
+    }
+    for (i = h->n++; i > 0; i = parent) {
+	parent = (i - 1) / 2;
+	if (!before(&e, &h->ev[parent]))
+	    break;
+	h->ev[i] = h->ev[parent];
+    }
+    h->ev[i] = e;
+}
+
+/*
+ * heap_pop - remove the earliest event and store it in *e
+ */
+static void heap_pop(heap_t *h, event_t *e)
+{
+    event_t last = h->ev[--h->n];
+    size_t i = 0, child;
+
+    *e = h->ev[0];
+    while ((child = 2 * i + 1) < h->n) {
+	if (child + 1 < h->n && before(&h->ev[child + 1], &h->ev[child]))
+	    child++;
+	if (!before(&h->ev[child], &last))
+	    break;
+	h->ev[i] = h->ev[child];
+	i = child;
+    }
+    h->ev[i] = last;
+}
+
+/*
+ * before - does event x come before event y?
+ */
+static int before(event_t *x, event_t *y)
+{
+    return x->time < y->time || (x->time == y->time && x->seq < y->seq);
+}
+
+/*
+ * usage - explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracegen [-b] [-s <seed>] <params> <out>\n");
+    fprintf(stderr, "  -b         Write a binary trace instead of a .rep.\n");
+    fprintf(stderr, "  -s <seed>  Override the seed in the parameter file.\n");
+    exit(1);
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}